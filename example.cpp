@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "greatestpp.h"
+
+/* Suite defined in example_suite.cpp. */
+SUITE(other_suite);
+
+/* Setup calls since the last teardown. Under -j, tests run on several
+ * threads at once, so each thread counts its own. */
+static thread_local int calls;
+
+TEST foo_should_foo(void) {
+    PASS();
+}
+
+TEST counts_calls(int expected) {
+    ASSERT_EQ(expected, calls);
+    PASS();
+}
+
+TEST compares_strings(void) {
+    ASSERT_STR_EQ("foo", "foo");
+    PASS();
+}
+
+static void setup_cb(void *data) {
+    (void)data;
+    calls++;
+}
+
+static void teardown_cb(void *data) {
+    (void)data;
+    calls = 0;
+}
+
+SUITE(suite) {
+    /* Optional setup/teardown callbacks which will be run before/after
+     * every test case in the suite.
+     * Cleared when the suite finishes. Under -j, they run on the worker
+     * threads, concurrently, so they must be thread-safe. */
+    SET_SETUP(setup_cb, NULL);
+    SET_TEARDOWN(teardown_cb, NULL);
+
+    RUN_TEST(foo_should_foo);
+    RUN_TEST1(counts_calls, 1);
+    RUN_TEST(compares_strings);
+}
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATESTPP_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATESTPP_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    RUN_SUITE(other_suite);
+    GREATESTPP_MAIN_END();        /* display results */
+}
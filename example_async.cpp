@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "greatestpp.h"
+
+/* A pipe one test waits to read from while another writes to it. The
+ * writer is queued first, so it still works with --async 1. */
+static int pipe_fds[2];
+
+ASYNC_TEST reads_pipe(void) {
+    char c = 0;
+    AWAIT_READABLE(pipe_fds[0]);
+    CO_ASSERT_EQ(1, (int)read(pipe_fds[0], &c, 1));
+    CO_ASSERT_EQ('x', c);
+    CO_PASS();
+}
+
+ASYNC_TEST writes_pipe(void) {
+    /* Let reads_pipe start and suspend first. */
+    AWAIT_SLEEP(10);
+    AWAIT_WRITABLE(pipe_fds[1]);
+    CO_ASSERT_EQ(1, (int)write(pipe_fds[1], "x", 1));
+    CO_PASS();
+}
+
+/* A regular file can't be polled, so it counts as ready at once. */
+ASYNC_TEST reads_file(void) {
+    char c;
+    int fd = open("example_async.cpp", O_RDONLY);
+    if (fd < 0) CO_SKIPm("run from the source directory");
+    AWAIT_READABLE(fd);
+    CO_ASSERT_EQ(1, (int)read(fd, &c, 1));
+    close(fd);
+    CO_PASS();
+}
+
+ASYNC_TEST sleeps(void) {
+    uint64_t start = greatestpp_now_ns();
+    AWAIT_SLEEP(20);
+    CO_ASSERT(greatestpp_now_ns() - start >= 20 * 1000000);
+    CO_PASS();
+}
+
+SUITE(async_suite) {
+    if (pipe(pipe_fds) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    RUN_ASYNC(writes_pipe);
+    RUN_ASYNC(reads_pipe);
+    RUN_ASYNC(reads_file);
+    RUN_ASYNC(sleeps);
+}
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATESTPP_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATESTPP_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(async_suite);
+    GREATESTPP_MAIN_END();        /* display results */
+}
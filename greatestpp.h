@@ -25,8 +25,12 @@
 #define GREATESTPP_VERSION_PATCH 0
 
 /* A unit testing system for C++, contained in 1 file.
- * It doesn't use dynamic allocation or depend on anything
- * beyond ANSI C89. It is based of of the C unit testing system
+ * It needs C++11 and its standard library: it uses threads for -j,
+ * and STL containers for filters, results and benchmarks. On POSIX
+ * systems it also uses fork for -p, and mmap for corpora; on Linux,
+ * epoll for ASYNC_TEST (with C++20), and perf_event_open and /proc
+ * for --perf and --memory-report. Each is detected, and left out
+ * where it's missing. It is based of of the C unit testing system
  * called "Greatest" created by Scott Vokes, vokes.s@gmail.com*/
 
 
@@ -55,7 +59,8 @@ static void teardown_cb(void *data) {
 SUITE(suite) {
     /* Optional setup/teardown callbacks which will be run before/after
      * every test case in the suite.
-     * Cleared when the suite finishes. */
+     * Cleared when the suite finishes. Under -j, they run on the worker
+     * threads, concurrently, so they must be thread-safe. */
     SET_SETUP(setup_cb, voidp_to_callback_data);
     SET_TEARDOWN(teardown_cb, voidp_to_callback_data);
 
@@ -75,11 +80,36 @@ int main(int argc, char **argv) {
 /*********************************************************************/
 
 
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 
 /***********
  * Options *
@@ -100,28 +130,302 @@ int main(int argc, char **argv) {
 #define GREATESTPP_USE_ABBREVS 1
 #endif
 
+/* Buffer size for the --output file. */
+#ifndef GREATESTPP_OUTPUT_BUFFER
+#define GREATESTPP_OUTPUT_BUFFER (64 * 1024)
+#endif
+
+/* Longest line read from a baseline or filter file; longer ones are
+ * errors rather than being split. */
+#ifndef GREATESTPP_MAX_LINE
+#define GREATESTPP_MAX_LINE (1024 * 1024)
+#endif
+
+/* Result cache every run reads and updates, for --failed-first,
+ * --rerun-failed and --order=duration, unless it's given --cache or
+ * --no-cache. */
+#ifndef GREATESTPP_DEFAULT_CACHE_FILE
+#define GREATESTPP_DEFAULT_CACHE_FILE ".greatestpp-cache"
+#endif
+
+/* Default time each benchmark sample should take, in ms. */
+#ifndef GREATESTPP_DEFAULT_BENCH_TIME_MS
+#define GREATESTPP_DEFAULT_BENCH_TIME_MS 10
+#endif
+
+/* Default number of timed samples per benchmark. */
+#ifndef GREATESTPP_DEFAULT_BENCH_SAMPLES
+#define GREATESTPP_DEFAULT_BENCH_SAMPLES 10
+#endif
+
+/* Default change in median time, in percent, that counts as a
+ * benchmark regression or improvement against --bench-compare. */
+#ifndef GREATESTPP_DEFAULT_BENCH_THRESHOLD
+#define GREATESTPP_DEFAULT_BENCH_THRESHOLD 5.0
+#endif
+
+/* Significance level for the Mann-Whitney U test against a baseline. */
+#ifndef GREATESTPP_BENCH_ALPHA
+#define GREATESTPP_BENCH_ALPHA 0.05
+#endif
+
+/* Default time in ms each STRESS_TEST runs for, unless it's given an
+ * iteration count; see --stress-time. */
+#ifndef GREATESTPP_DEFAULT_STRESS_TIME_MS
+#define GREATESTPP_DEFAULT_STRESS_TIME_MS 1000
+#endif
+
+/* Default number of async tests run at once, for --async. */
+#ifndef GREATESTPP_DEFAULT_ASYNC_LIMIT
+#define GREATESTPP_DEFAULT_ASYNC_LIMIT 64
+#endif
+
+/* Records the --journal file first has room for. It doubles in size
+ * whenever it fills up. */
+#ifndef GREATESTPP_JOURNAL_RECORDS
+#define GREATESTPP_JOURNAL_RECORDS 1024
+#endif
+
+/* Time each attempt of ASSERT_P99_UNDER or ASSERT_FASTER_THAN may
+ * take, in ms, not counting warmup. */
+#ifndef GREATESTPP_LATENCY_TIME_MS
+#define GREATESTPP_LATENCY_TIME_MS 100
+#endif
+
+/* Attempts before a latency assertion fails, each with twice the
+ * samples of the last, for machines with noisy neighbours. */
+#ifndef GREATESTPP_LATENCY_ATTEMPTS
+#define GREATESTPP_LATENCY_ATTEMPTS 3
+#endif
+
+/* Stack samples --profile takes per second of CPU time. The kernel
+ * may round the interval up to its timer tick. */
+#ifndef GREATESTPP_PROFILE_HZ
+#define GREATESTPP_PROFILE_HZ 1000
+#endif
+
+/* Samples --profile keeps per test, and frames per sample. Samples
+ * past the limit are only counted. */
+#ifndef GREATESTPP_PROFILE_SAMPLES
+#define GREATESTPP_PROFILE_SAMPLES 8192
+#endif
+#ifndef GREATESTPP_PROFILE_DEPTH
+#define GREATESTPP_PROFILE_DEPTH 64
+#endif
+
+/* Keep the failure paths of the assertions out of the way of the
+ * passing ones, which may run in tight loops. */
+#if defined(__GNUC__)
+#define GREATESTPP_COLD __attribute__((cold, noinline))
+#define GREATESTPP_UNLIKELY(COND) __builtin_expect(!!(COND), 0)
+#else
+#define GREATESTPP_COLD
+#define GREATESTPP_UNLIKELY(COND) (COND)
+#endif
+
+/* ASSERT_EQ(NULL, ptr) binds NULL to a reference, which GCC warns
+ * about when NULL is __null. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define GREATESTPP_NULL_OK_BEGIN                                        \
+    _Pragma("GCC diagnostic push")                                      \
+    _Pragma("GCC diagnostic ignored \"-Wconversion-null\"")
+#define GREATESTPP_NULL_OK_END _Pragma("GCC diagnostic pop")
+#else
+#define GREATESTPP_NULL_OK_BEGIN
+#define GREATESTPP_NULL_OK_END
+#endif
+
+/* Support running tests in forked worker processes (-p N)? */
+#ifndef GREATESTPP_HAVE_FORK
+#if defined(__unix__) || defined(__APPLE__)
+#define GREATESTPP_HAVE_FORK 1
+#else
+#define GREATESTPP_HAVE_FORK 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_FORK
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/* Memory-map RUN_CORPUS files, and read corpus directories? Otherwise
+ * only single corpus files can be used, and are read into memory. */
+#ifndef GREATESTPP_HAVE_MMAP
+#if defined(__unix__) || defined(__APPLE__)
+#define GREATESTPP_HAVE_MMAP 1
+#else
+#define GREATESTPP_HAVE_MMAP 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_MMAP
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Support ASYNC_TEST, C++20 coroutines run on an epoll loop? */
+#ifndef GREATESTPP_HAVE_ASYNC
+#if defined(__cpp_impl_coroutine) && defined(__linux__)
+#define GREATESTPP_HAVE_ASYNC 1
+#else
+#define GREATESTPP_HAVE_ASYNC 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_ASYNC
+#include <errno.h>
+#include <coroutine>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+/* Support reading hardware counters with perf_event_open (--perf)? */
+#ifndef GREATESTPP_HAVE_PERF
+#if defined(__linux__)
+#define GREATESTPP_HAVE_PERF 1
+#else
+#define GREATESTPP_HAVE_PERF 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_PERF
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Support measuring each test's RSS from /proc (--memory-report,
+ * ASSERT_RSS_UNDER)? */
+#ifndef GREATESTPP_HAVE_RSS
+#if defined(__linux__)
+#define GREATESTPP_HAVE_RSS 1
+#else
+#define GREATESTPP_HAVE_RSS 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_RSS
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+/* Support pinning STRESS_TEST threads to CPUs (--stress-pin)? */
+#ifndef GREATESTPP_HAVE_AFFINITY
+#if defined(__linux__) && defined(__GLIBC__)
+#define GREATESTPP_HAVE_AFFINITY 1
+#else
+#define GREATESTPP_HAVE_AFFINITY 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_AFFINITY
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* Support sampling stacks with SIGPROF and backtrace() (--profile)?
+ * With glibc before 2.34, link with -ldl for dladdr(). */
+#ifndef GREATESTPP_HAVE_PROFILE
+#if (defined(__linux__) && defined(__GLIBC__)) || defined(__APPLE__)
+#define GREATESTPP_HAVE_PROFILE 1
+#else
+#define GREATESTPP_HAVE_PROFILE 0
+#endif
+#endif
+
+#if GREATESTPP_HAVE_PROFILE
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined(__linux__)
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+/* Define GREATESTPP_TRACK_ALLOCS before including this header to
+ * count each test's heap allocations. The file that expands
+ * GREATESTPP_MAIN_DEFS() then replaces malloc and friends (glibc) or
+ * the global operator new and delete (elsewhere). */
+#ifdef GREATESTPP_TRACK_ALLOCS
+#define GREATESTPP_TRACKING_ALLOCS 1
+#include <cstddef>
+#include <new>
+#if defined(__GLIBC__)
+#include <errno.h>
+#include <malloc.h>
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *p);
+}
+#endif
+#else
+#define GREATESTPP_TRACKING_ALLOCS 0
+#endif
+
 
 /*********
  * Types *
  *********/
 
+/* A point in time: monotonic wall-clock time and CPU time, in ns. */
+typedef struct greatestpp_time {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+} greatestpp_time;
+
 /* Info for the current running suite. */
 typedef struct greatestpp_suite_info {
+    const char *name;
     unsigned int tests_run;
     unsigned int passed;
     unsigned int failed;
     unsigned int skipped;
 
     /* timers, pre/post running suite and individual tests */
-    clock_t pre_suite;
-    clock_t post_suite;
-    clock_t pre_test;
-    clock_t post_test;
+    greatestpp_time pre_suite;
+    greatestpp_time post_suite;
+    greatestpp_time pre_test;
+    greatestpp_time post_test;
 } greatestpp_suite_info;
 
 /* Type for a suite function. */
 typedef void (greatestpp_suite_cb)(void);
 
+/* Type for a test function without arguments. */
+typedef int (greatestpp_test_cb)(void);
+
+/* A test registered at startup by GREATESTPP_TEST_CASE. */
+typedef struct greatestpp_test_desc {
+    const char *suite;
+    const char *name;
+    const char *file;
+    unsigned int line;
+    greatestpp_test_cb *test;
+    const char *tags;           /* comma-separated, or NULL */
+} greatestpp_test_desc;
+
 /* Types for setup/teardown callbacks. If non-NULL, these will be run
  * and passed the pointer to their additional data. */
 typedef void (greatestpp_setup_cb)(void *udata);
@@ -130,9 +434,427 @@ typedef void (greatestpp_teardown_cb)(void *udata);
 typedef enum {
     GREATESTPP_FLAG_VERBOSE = 0x01,
     GREATESTPP_FLAG_FIRST_FAIL = 0x02,
-    GREATESTPP_FLAG_LIST_ONLY = 0x04
+    GREATESTPP_FLAG_LIST_ONLY = 0x04,
+    GREATESTPP_FLAG_TIMINGS = 0x08,    /* keep per-test timings */
+    GREATESTPP_FLAG_BENCH = 0x10,      /* run benchmarks, not tests */
+    GREATESTPP_FLAG_PERF = 0x20,       /* read hardware counters */
+    GREATESTPP_FLAG_FAILED_FIRST = 0x40,  /* run cached failures first */
+    GREATESTPP_FLAG_RERUN_FAILED = 0x80,  /* only run cached failures */
+    GREATESTPP_FLAG_ORDER_DURATION = 0x100, /* run slowest tests first */
+    GREATESTPP_FLAG_STRESS_PIN = 0x200, /* pin stress threads to CPUs */
+    GREATESTPP_FLAG_MEMORY = 0x400,    /* measure each test's RSS */
+    GREATESTPP_FLAG_NO_CACHE = 0x800   /* don't read or write the cache */
 } GREATESTPP_FLAG;
 
+/* A test's memory use, from --memory-report: the process's RSS when
+ * the test started and ended, and at its peak in between, in kB, and
+ * the page faults the test's thread took. */
+typedef struct greatestpp_memory {
+    uint64_t start_kb;
+    uint64_t end_kb;
+    uint64_t peak_kb;
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    int sampled;                /* 0 if not measured */
+} greatestpp_memory;
+
+/* Hardware counters for a test body or benchmark, read with --perf. */
+typedef struct greatestpp_perf {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t branch_misses;
+    uint64_t cache_misses;
+} greatestpp_perf;
+
+#if GREATESTPP_HAVE_PERF
+#define GREATESTPP_PERF_EVENTS 4
+
+/* One thread's perf_event_open group, led by the cycle counter. An
+ * event that could not be opened has an fd of -1. */
+typedef struct greatestpp_perf_group {
+    int opened;
+    int fd[GREATESTPP_PERF_EVENTS];
+    greatestpp_perf_group() : opened(0) {
+        for (int i = 0; i < GREATESTPP_PERF_EVENTS; i++) fd[i] = -1;
+    }
+    ~greatestpp_perf_group();
+} greatestpp_perf_group;
+#endif
+
+#if GREATESTPP_HAVE_PROFILE
+/* One stack sampled by --profile, innermost frame first. */
+typedef struct greatestpp_profile_sample {
+    int depth;
+    void *pc[GREATESTPP_PROFILE_DEPTH];
+} greatestpp_profile_sample;
+
+/* A function in the test runner's own symbol table, which dladdr()
+ * can't see static functions in. ADDR is relative to its load base. */
+typedef struct greatestpp_profile_symbol {
+    uintptr_t addr;
+    uintptr_t size;
+    const char *name;
+    bool operator<(const greatestpp_profile_symbol &o) const {
+        return addr < o.addr;
+    }
+} greatestpp_profile_symbol;
+
+/* The --profile sampler. The SIGPROF handler only fills in samples
+ * while a test body runs; they're symbolized after it returns. */
+typedef struct greatestpp_profiler {
+    greatestpp_profile_sample *samples; /* NULL unless profiling */
+    volatile sig_atomic_t active;
+    volatile sig_atomic_t count;
+    volatile sig_atomic_t dropped;
+    std::unordered_map<void *, std::string> frames; /* symbol cache */
+    std::vector<greatestpp_profile_symbol> symbols; /* sorted by addr */
+    std::vector<char> strtab;
+    void *exe_base;
+} greatestpp_profiler;
+#endif
+
+/* Passed to a benchmark, which should run the code being measured
+ * ITERATIONS times. It can set BYTES and/or ITEMS to the amount of
+ * work done per iteration, to have throughput reported too. */
+typedef struct greatestpp_bench {
+    uint64_t iterations;
+    uint64_t bytes;
+    uint64_t items;
+} greatestpp_bench;
+
+/* Type for a benchmark function. */
+typedef int (greatestpp_bench_cb)(greatestpp_bench *b);
+
+/* Passed to each call of a stress test's body: which of the THREADS
+ * threads running it this is, and how many calls that thread has made
+ * before this one. */
+typedef struct greatestpp_stress {
+    unsigned int thread;
+    unsigned int threads;
+    uint64_t iteration;
+} greatestpp_stress;
+
+/* Type for a stress test's body, called over and over on each thread.
+ * Each call counts as one operation. */
+typedef int (greatestpp_stress_cb)(greatestpp_stress *s);
+
+/* A finished benchmark's samples, in ns per iteration, and stats. */
+typedef struct greatestpp_bench_result {
+    const char *suite;
+    const char *name;
+    uint64_t iterations;        /* per sample */
+    uint64_t bytes;
+    uint64_t items;
+    greatestpp_perf perf;       /* summed over the timed samples */
+    std::vector<double> samples;
+    double mean;
+    double median;
+    double stddev;
+    double min;
+} greatestpp_bench_result;
+
+/* Distribution of the calls timed by ASSERT_P99_UNDER, in ns, after
+ * subtracting the clock's own overhead. */
+typedef struct greatestpp_latency {
+    size_t samples;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+} greatestpp_latency;
+
+/* Time N samples of BATCH calls to the callable FN, in ns per call. */
+typedef void greatestpp_sample_cb(void *fn, uint64_t batch, double *ns,
+                                  size_t n);
+
+/* A benchmark's samples loaded from a --bench-compare file. */
+typedef struct greatestpp_bench_baseline {
+    std::string suite;
+    std::string name;
+    std::vector<double> samples;
+} greatestpp_bench_baseline;
+
+/* Heap use between a test's setup and teardown callbacks, counted
+ * when built with GREATESTPP_TRACK_ALLOCS. Only the test's own thread
+ * is counted. */
+typedef struct greatestpp_alloc_stats {
+    uint64_t allocs;            /* blocks allocated */
+    uint64_t frees;             /* blocks freed */
+    uint64_t bytes;             /* bytes requested */
+    int64_t live;               /* bytes still allocated at the end */
+    int64_t peak;               /* most bytes allocated at once */
+} greatestpp_alloc_stats;
+
+/* Info about the test running on the current thread. The assertion
+ * macros only touch this, so tests can run on worker threads. */
+typedef struct greatestpp_test_info {
+    /* info to print about the most recent failure */
+    const char *fail_file;
+    unsigned int fail_line;
+    const char *msg;
+    greatestpp_alloc_stats allocs;
+    greatestpp_perf perf;
+    greatestpp_memory mem;
+} greatestpp_test_info;
+
+/* A test queued by RUN_TEST when running with -j N, along with
+ * the callbacks it was queued with and its result once run. */
+typedef struct greatestpp_job {
+    const char *name;
+    std::function<int(void)> test;
+    greatestpp_setup_cb *setup;
+    void *setup_udata;
+    greatestpp_teardown_cb *teardown;
+    void *teardown_udata;
+    unsigned int timeout_ms;    /* 0 for no timeout */
+
+    int ran;
+    int res;
+    greatestpp_test_info info;
+    greatestpp_time pre_test;
+    greatestpp_time post_test;
+
+    /* copies of info's strings, for results from a forked worker */
+    std::string msg_buf;
+    std::string file_buf;
+} greatestpp_job;
+
+/* One worker's deque of job indexes. The owner pops from the front,
+ * idle workers steal from the back. */
+typedef struct greatestpp_worker_queue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+} greatestpp_worker_queue;
+
+/* Deadline of the test running on one thread, for the watchdog. */
+typedef struct greatestpp_deadline {
+    std::thread::id thread;
+    std::chrono::steady_clock::time_point due;
+    const char *name;
+    size_t job;                 /* its -j job, or SIZE_MAX */
+    unsigned int timeout_ms;
+    greatestpp_time start;
+} greatestpp_deadline;
+
+/* Work-stealing thread pool for -j N. The threads are started for
+ * the first suite with queued tests and live until exit. */
+typedef struct greatestpp_pool {
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<greatestpp_worker_queue> > queues;
+    std::vector<greatestpp_job> jobs;   /* current suite, in order */
+
+    std::mutex lock;
+    std::condition_variable wake;       /* new batch, or stopping */
+    std::condition_variable idle;       /* batch finished */
+    unsigned int generation;
+    size_t remaining;                   /* jobs and workers not done */
+    int stop;
+    std::atomic<size_t> first_fail;     /* lowest failed job, with -f */
+    int timed_out;                      /* a job missed its deadline */
+    greatestpp_deadline timeout;        /* ...which was this one */
+
+    greatestpp_pool()
+        : generation(0), remaining(0), stop(0), first_fail(SIZE_MAX),
+          timed_out(0) {}
+    ~greatestpp_pool();
+} greatestpp_pool;
+
+#if GREATESTPP_HAVE_FORK
+/* A forked worker process for -p N. */
+typedef struct greatestpp_fork_worker {
+    pid_t pid;
+    int cmd_fd;                 /* parent -> worker: job indexes */
+    int res_fd;                 /* worker -> parent: results */
+    size_t job;                 /* job it's running, or SIZE_MAX */
+    unsigned int jobs_run;      /* jobs sent to it, for --fork-batch */
+    greatestpp_time started;    /* when it was sent the job */
+    uint64_t deadline_ns;       /* wall time to kill it, or 0 */
+} greatestpp_fork_worker;
+
+/* Result a forked worker sends back for each job. The message and
+ * fail_file strings follow it on the pipe. */
+typedef struct greatestpp_fork_record {
+    uint64_t index;
+    int32_t res;
+    uint32_t fail_line;
+    uint32_t msg_len;           /* UINT32_MAX for a NULL msg */
+    uint32_t file_len;          /* UINT32_MAX for a NULL fail_file */
+    greatestpp_time pre_test;
+    greatestpp_time post_test;
+    greatestpp_alloc_stats allocs;
+    greatestpp_perf perf;
+    greatestpp_memory mem;
+} greatestpp_fork_record;
+#endif
+
+/* State in the Aho-Corasick automaton for substring patterns. */
+typedef struct greatestpp_ac_state {
+    std::vector<std::pair<unsigned char, uint32_t> > next;  /* sorted */
+    uint32_t fail;
+    int match;                  /* a pattern ends here, or in a suffix */
+} greatestpp_ac_state;
+
+/* A set of name patterns, compiled for fast matching. A pattern is
+ * an exact name if it starts with '=', a glob if it has any of "*?[",
+ * and a substring otherwise. */
+typedef struct greatestpp_pattern_set {
+    std::vector<std::string> patterns;
+    std::vector<std::string> exact;
+    std::unordered_multimap<uint64_t, size_t> exact_index;
+    std::vector<std::string> substrings;
+    std::vector<greatestpp_ac_state> automaton;
+    std::vector<std::string> globs;
+} greatestpp_pattern_set;
+
+/* Suite and test filters. A name passes if it matches any include
+ * pattern (or there are none) and no exclude pattern. */
+typedef struct greatestpp_filter {
+    greatestpp_pattern_set include;
+    greatestpp_pattern_set exclude;
+} greatestpp_filter;
+
+typedef struct greatestpp_filters {
+    greatestpp_filter suites;
+    greatestpp_filter tests;
+} greatestpp_filters;
+
+/* Receives the run's results, in order, on the main thread. The
+ * console reporter prints the ".....F" output to GREATESTPP_STDOUT;
+ * the others write a TAP, JUnit XML or JSON Lines report to the
+ * --output file (or stdout). */
+typedef struct greatestpp_reporter {
+    const char *name;
+    void (*run_begin)(void);
+    void (*suite_begin)(const char *suite_name);
+    void (*test_end)(const char *name, int res,
+                     const greatestpp_test_info *info,
+                     greatestpp_time pre, greatestpp_time post);
+    void (*suite_end)(const char *suite_name);
+    void (*run_end)(void);
+} greatestpp_reporter;
+
+/* A test's outcome in the last run that ran it, from the --cache file. */
+typedef struct greatestpp_cache_entry {
+    int res;
+    uint64_t wall_ns;
+} greatestpp_cache_entry;
+
+/* Lifetimes of GREATESTPP_SUITE_FIXTURE and GREATESTPP_GLOBAL_FIXTURE. */
+typedef enum {
+    GREATESTPP_SCOPE_SUITE,     /* until the end of the suite */
+    GREATESTPP_SCOPE_GLOBAL     /* until the thread exits */
+} GREATESTPP_SCOPE;
+
+/* One fixture instance, made by the thread that uses it. */
+typedef struct greatestpp_fixture_slot {
+    const void *type;           /* &greatestpp_fixture_id<T>::id */
+    GREATESTPP_SCOPE scope;
+    void *instance;
+    void (*destroy)(void *instance);
+} greatestpp_fixture_slot;
+
+/* A thread's fixture instances. */
+typedef struct greatestpp_fixture_set {
+    std::vector<greatestpp_fixture_slot> slots;
+    ~greatestpp_fixture_set();
+} greatestpp_fixture_set;
+
+/* Watchdog thread for --timeout, started by the first armed test. It
+ * sleeps until the nearest deadline; a test that misses it is reported
+ * as a timeout and the run stops, since a thread can't be killed. */
+typedef struct greatestpp_watchdog {
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<greatestpp_deadline> armed;
+    bool stop;
+    ~greatestpp_watchdog();
+} greatestpp_watchdog;
+
+/* A run of bytes in a corpus, not NUL-terminated. */
+typedef struct greatestpp_slice {
+    const char *data;
+    size_t size;
+} greatestpp_slice;
+
+/* One record of a RUN_CORPUS corpus, passed to the test. Its slices
+ * point into the mapped corpus, which stays mapped for the whole run. */
+typedef struct greatestpp_record {
+    size_t index;               /* position in the corpus */
+    const char *name;           /* "TEST/key", as reported */
+    greatestpp_slice key;       /* the record's own name */
+    greatestpp_slice input;
+    greatestpp_slice expected;  /* empty if the record has none */
+} greatestpp_record;
+
+/* A loaded corpus: its mappings (or buffers, without mmap), and the
+ * records and names pointing into them. */
+typedef struct greatestpp_corpus {
+    std::vector<greatestpp_slice> maps;
+    std::deque<std::string> buffers;
+    std::deque<std::string> names;
+    std::vector<greatestpp_record> records;
+    ~greatestpp_corpus();
+} greatestpp_corpus;
+
+/* Kinds of --journal record. The kind is written last, so a record
+ * cut short by a crash reads as GREATESTPP_JOURNAL_EMPTY. */
+typedef enum {
+    GREATESTPP_JOURNAL_EMPTY,
+    GREATESTPP_JOURNAL_TEST,
+    GREATESTPP_JOURNAL_SUITE,   /* a suite ended */
+    GREATESTPP_JOURNAL_END      /* the run ended */
+} GREATESTPP_JOURNAL_KIND;
+
+#define GREATESTPP_JOURNAL_MAGIC "GPPJRNL1"
+
+/* One --journal record. Names and messages are cut short to fit.
+ * Times are in ns: the wall clock at the start, then the wall and CPU
+ * time taken. */
+typedef struct greatestpp_journal_record {
+    uint32_t kind;
+    int32_t res;
+    uint32_t fail_line;
+    uint32_t reserved;
+    uint64_t start_ns;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    char suite[64];
+    char name[128];             /* the suite's, for a suite record */
+    char file[96];
+    char msg[184];
+} greatestpp_journal_record;
+
+/* The --journal file starts with a header the size of a record. */
+typedef struct greatestpp_journal_header {
+    char magic[8];              /* GREATESTPP_JOURNAL_MAGIC */
+    uint32_t record_size;
+    char unused[sizeof(greatestpp_journal_record) - 12];
+} greatestpp_journal_header;
+
+/* The --journal being written: mapped, or a FILE * without mmap. */
+typedef struct greatestpp_journal {
+    bool active;
+    int fd;
+    char *map;
+    size_t capacity;            /* records the mapping has room for */
+    size_t count;
+    FILE *file;
+    greatestpp_journal_record scratch;
+} greatestpp_journal;
+
+/* Timing for one finished test, kept for --slowest and --timings. */
+typedef struct greatestpp_timing {
+    const char *suite;
+    const char *name;
+    int res;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    greatestpp_perf perf;
+    greatestpp_memory mem;
+} greatestpp_timing;
+
 typedef struct greatestpp_run_info {
     unsigned int flags;
     unsigned int tests_run;     /* total test count */
@@ -145,10 +867,16 @@ typedef struct greatestpp_run_info {
     /* currently running test suite */
     greatestpp_suite_info suite;
 
-    /* info to print about the most recent failure */
-    const char *fail_file;
-    unsigned int fail_line;
-    const char *msg;
+    /* worker thread count, from -j */
+    unsigned int jobs;
+
+    /* worker process count, from -p, and how many tests each worker
+     * runs before it's replaced by a fresh fork, from --fork-batch */
+    unsigned int forks;
+    unsigned int fork_batch;    /* 0: no limit */
+
+    /* async tests run at once, from --async */
+    unsigned int async_limit;
 
     /* current setup/teardown hooks and userdata */
     greatestpp_setup_cb *setup;
@@ -160,32 +888,205 @@ typedef struct greatestpp_run_info {
     unsigned int col;
     unsigned int width;
 
-    /* only run a specific suite or test */
-    char *suite_filter;
-    char *test_filter;
+    /* only run tests with this tag, from --tag */
+    const char *tag_filter;
+
+    /* tags of the test being started, if it was registered */
+    const char *test_tags;
+
+    /* registered tests in the suite being run */
+    size_t registered_begin;
+    size_t registered_end;
+
+    /* per-test timeouts in ms: --timeout, GREATESTPP_SET_TIMEOUT in
+     * the current suite, and GREATESTPP_RUN_TEST_TIMEOUT */
+    unsigned int timeout_ms;
+    unsigned int suite_timeout_ms;
+    unsigned int test_timeout_ms;
+
+    /* result cache, from --cache, and how many failures it holds */
+    const char *cache_file;
+    unsigned int cache_failures;
+
+    /* run only shard shard_index of shard_count, from --shard, and the
+     * --shard-timings file to balance the shards with */
+    unsigned int shard_index;
+    unsigned int shard_count;   /* 0: not sharding */
+    const char *shard_timings_file;
+
+    /* record results as they come in, from --journal, or report them
+     * from a journal instead of running tests, from --journal-report */
+    const char *journal_file;
+    const char *journal_report_file;
+
+    /* write each test's stack samples to a folded-stack file in this
+     * directory, from --profile, but only for tests that took at least
+     * --profile-threshold ms */
+    const char *profile_dir;
+    unsigned int profile_threshold_ms;
+
+    /* print the N slowest tests at the end, from --slowest */
+    unsigned int slowest;
+
+    /* print the N tests whose RSS grew the most, from --memory-report */
+    unsigned int memory_report;
+
+    /* file to write per-test timings to, from --timings */
+    const char *timings_file;
+
+    /* time each STRESS_TEST runs for, from --stress-time */
+    unsigned int stress_time_ms;
+
+    /* target time per benchmark sample and sample count */
+    unsigned int bench_time_ms;
+    unsigned int bench_samples;
+
+    /* benchmark baseline files, and the regressions found */
+    const char *bench_save_file;
+    const char *bench_compare_file;
+    double bench_threshold;
+    unsigned int bench_regressions;
+
+    /* where results go, from --reporter and --output */
+    const greatestpp_reporter *reporter;
+    const char *out_path;
+    FILE *out;
+    unsigned int reported;      /* tests passed to the reporter */
 
     /* overall timers */
-    clock_t begin;
-    clock_t end;
+    greatestpp_time begin;
+    greatestpp_time end;
 } greatestpp_run_info;
 
 /* Global var for the current testing context.
- * Initialized by GREATEST_MAIN_DEFS(). */
-extern greatestpp_run_info greatest_info;
+ * Initialized by GREATESTPP_MAIN_DEFS(). */
+extern greatestpp_run_info greatestpp_info;
+
+/* Per-thread var for the test currently running. */
+extern thread_local greatestpp_test_info greatestpp_test;
+
+#ifdef GREATESTPP_TRACK_ALLOCS
+/* Allocation counts for the test running on this thread. */
+typedef struct greatestpp_alloc_counter {
+    int active;                 /* counting? */
+    greatestpp_alloc_stats stats;
+} greatestpp_alloc_counter;
+
+extern thread_local greatestpp_alloc_counter greatestpp_alloc_tls;
+#endif
+
+/* Per-thread fixture instances, so each -j worker has its own. */
+extern thread_local greatestpp_fixture_set greatestpp_fixtures;
+
+/* Failure message built by ASSERT_EQ and ASSERT_STR_EQ, with the
+ * values that didn't match. */
+extern thread_local std::string greatestpp_fail_msg;
+
+/* Suite and test filters, compiled by GREATESTPP_MAIN_BEGIN(). */
+extern greatestpp_filters greatestpp_filter_info;
+
+/* Watchdog for tests run in-process with a timeout. */
+extern greatestpp_watchdog greatestpp_watch;
+
+/* Worker threads and queued tests for -j N. */
+extern greatestpp_pool greatestpp_workers;
+
+/* Finished tests' timings, in the order they were reported. */
+extern std::vector<greatestpp_timing> greatestpp_timings;
+
+/* Finished benchmarks, in the order they were run. */
+extern std::vector<greatestpp_bench_result> greatestpp_bench_results;
+
+/* Results from the --cache file, keyed by "suite\ttest". */
+extern std::unordered_map<std::string, greatestpp_cache_entry> greatestpp_cache;
+
+/* Shard of each test in the --shard-timings file, keyed by
+ * "suite\ttest". */
+extern std::unordered_map<std::string, unsigned int> greatestpp_shard_plan;
+
+/* Corpora loaded by RUN_CORPUS, kept until the end of the run. */
+extern std::vector<std::unique_ptr<greatestpp_corpus> > greatestpp_corpora;
+
+/* The --journal file, if any. */
+extern greatestpp_journal greatestpp_journal_out;
+
+/* Benchmarks loaded from the --bench-compare file. */
+extern std::vector<greatestpp_bench_baseline> greatestpp_bench_baselines;
 
 
 /**********************
  * Exported functions *
  **********************/
 
-void greatestpp_do_pass(const char *name);
-void greatestpp_do_fail(const char *name);
-void greatestpp_do_skip(const char *name);
+std::vector<greatestpp_test_desc> &greatestpp_registry(void);
+void greatestpp_run_registered(void);
+
+void greatestpp_do_pass(const char *name, const greatestpp_test_info *info);
+void greatestpp_do_fail(const char *name, const greatestpp_test_info *info);
+void greatestpp_do_skip(const char *name, const greatestpp_test_info *info);
 int greatestpp_pre_test(const char *name);
 void greatestpp_post_test(const char *name, int res);
+void greatestpp_queue_test(const char *name, std::function<int(void)> test);
+int greatestpp_pre_bench(const char *name);
+void greatestpp_run_bench(const char *name, greatestpp_bench_cb *bench);
+int greatestpp_read_line(FILE *f, std::string *line);
+int greatestpp_load_bench_baseline(const char *path);
+void greatestpp_save_bench_baseline(void);
+void greatestpp_load_cache(void);
+greatestpp_corpus *greatestpp_load_corpus(const char *test, const char *path);
+void greatestpp_plan_shards(void);
+void greatestpp_save_cache(void);
 void greatestpp_usage(const char *name);
-void GREATESTPP_SET_SETUP_CB(greatest_setup_cb *cb, void *udata);
-void GREATESTPP_SET_TEARDOWN_CB(greatest_teardown_cb *cb, void *udata);
+int greatestpp_get_time(greatestpp_time *t, int process);
+void greatestpp_report_timings(void);
+void greatestpp_parse_args(int argc, char **argv);
+void greatestpp_perf_init(void);
+void greatestpp_memory_init(void);
+void greatestpp_profile_init(void);
+void greatestpp_open_report(void);
+FILE *greatestpp_notes(void);
+void greatestpp_close_report(void);
+void greatestpp_replay_journal(void);
+void greatestpp_open_journal(void);
+void greatestpp_close_journal(void);
+void greatestpp_add_filter(greatestpp_pattern_set *set, const char *pattern);
+int greatestpp_load_filter_file(const char *path);
+void greatestpp_compile_filters(void);
+int greatestpp_filter_match(const greatestpp_filter *filter, const char *name);
+void GREATESTPP_SET_SETUP_CB(greatestpp_setup_cb *cb, void *udata);
+void GREATESTPP_SET_TEARDOWN_CB(greatestpp_teardown_cb *cb, void *udata);
+void GREATESTPP_SET_TIMEOUT(unsigned int ms);
+void greatestpp_release_fixtures(GREATESTPP_SCOPE scope);
+GREATESTPP_COLD void greatestpp_fail_at(const char *msg, const char *file,
+                                        unsigned int line);
+int greatestpp_check_p99(const char *msg, const char *file,
+                         unsigned int line, double limit_ns,
+                         greatestpp_sample_cb *sample, void *fn);
+int greatestpp_check_faster(const char *msg, const char *file,
+                            unsigned int line, double ratio,
+                            greatestpp_sample_cb *fast_sample, void *fast,
+                            greatestpp_sample_cb *slow_sample, void *slow);
+int greatestpp_run_stress(greatestpp_stress_cb *body, unsigned int threads,
+                          uint64_t iterations);
+int greatestpp_check_rss(const char *msg, const char *file,
+                         unsigned int line, uint64_t limit_kb);
+
+
+/* Adds a test to greatestpp_registry() during static initialization. */
+struct greatestpp_registrar {
+    greatestpp_registrar(const char *suite, const char *name,
+                         const char *file, unsigned int line,
+                         greatestpp_test_cb *test, const char *tags) {
+        greatestpp_test_desc desc;
+        desc.suite = suite;
+        desc.name = name;
+        desc.file = file;
+        desc.line = line;
+        desc.test = test;
+        desc.tags = tags;
+        greatestpp_registry().push_back(desc);
+    }
+};
 
 
 /**********
@@ -199,299 +1100,4796 @@ void GREATESTPP_SET_TEARDOWN_CB(greatest_teardown_cb *cb, void *udata);
  * The arguments are not included, to allow parametric testing. */
 #define GREATESTPP_TEST static int
 
+/* Start defining a benchmark, which takes a greatestpp_bench *. */
+#define GREATESTPP_BENCH static int
+
 /* Run a suite. */
 #define GREATESTPP_RUN_SUITE(S_NAME) greatestpp_run_suite(S_NAME, #S_NAME)
 
+/* Define a test and register it in S_NAME at startup, instead of
+ * calling RUN_TEST from a suite function. TAGS is a string of
+ * comma-separated tags for --tag, or NULL. */
+#define GREATESTPP_TEST_CASE(S_NAME, NAME)                                \
+    GREATESTPP_TEST_CASE_TAGGED(S_NAME, NAME, NULL)
+
+#define GREATESTPP_TEST_CASE_TAGGED(S_NAME, NAME, TAGS)                 \
+    static int NAME(void);                                              \
+    static greatestpp_registrar greatestpp_registrar_##NAME(            \
+        #S_NAME, #NAME, __FILE__, __LINE__, NAME, TAGS);                \
+    static int NAME(void)
+
+/* Run every registered test, grouped into suites. */
+#define GREATESTPP_RUN_REGISTERED() greatestpp_run_registered()
+
 /* Run a test in the current suite. */
 #define GREATESTPP_RUN_TEST(TEST)                                         \
+    GREATESTPP_RUN_CALL(#TEST, TEST())
+
+/* Run a test with its own timeout in ms, overriding --timeout and
+ * GREATESTPP_SET_TIMEOUT. */
+#define GREATESTPP_RUN_TEST_TIMEOUT(TEST, MS)                           \
     do {                                                                \
-        if (greatestpp_pre_test(#TEST) == 1) {                            \
-            int res = TEST();                                           \
-            greatestpp_post_test(#TEST, res);                             \
-        } else if (GREATESTPP_LIST_ONLY()) {                              \
-            fprintf(GREATESTPP_STDOUT, "  %s\n", #TEST);                  \
-        }                                                               \
+        greatestpp_info.test_timeout_ms = (MS);                         \
+        GREATESTPP_RUN_TEST(TEST);                                      \
+        greatestpp_info.test_timeout_ms = 0;                            \
     } while (0)
 
 /* Run a test in the current suite with one void* argument,
  * which can be a pointer to a struct with multiple arguments. */
 #define GREATESTPP_RUN_TEST1(TEST, ENV)                                   \
-    do {                                                                \
-        if (greatestpp_pre_test(#TEST) == 1) {                            \
-            int res = TEST(ENV);                                        \
-            greatestpp_post_test(#TEST, res);                             \
-        } else if (GREATESTPP_LIST_ONLY()) {                              \
-            fprintf(GREATESTPP_STDOUT, "  %s\n", #TEST);                  \
-        }                                                               \
-    } while (0)
+    GREATESTPP_RUN_CALL(#TEST, TEST(ENV))
 
-/* If __VA_ARGS__ (C99) is supported, allow parametric testing
+/* If __VA_ARGS__ (C99, C++11) is supported, allow parametric testing
  * without needing to manually manage the argument struct. */
-#if __STDC_VERSION__ >= 19901L
+#if __cplusplus >= 201103L || __STDC_VERSION__ >= 199901L
 #define GREATESTPP_RUN_TESTp(TEST, ...)                                   \
+    GREATESTPP_RUN_CALL(#TEST, TEST(__VA_ARGS__))
+#endif
+
+/* Run TEST(const greatestpp_record *) once per record of the corpus at
+ * PATH, as "TEST/key". PATH is either a file of records, each starting
+ * with a "=== key" line and optionally split into input and expected
+ * output by a "--- expected" line, or a directory with a record per
+ * file, whose expected output is in "FILE.expected" if there is one.
+ * A file without any "===" lines is a single record. */
+#define GREATESTPP_RUN_CORPUS(TEST, PATH)                               \
     do {                                                                \
-        if (greatestpp_pre_test(#TEST) == 1) {                            \
-            int res = TEST(__VA_ARGS__);                                \
-            greatestpp_post_test(#TEST, res);                             \
-        } else if (GREATESTPP_LIST_ONLY()) {                              \
-            fprintf(GREATESTPP_STDOUT, "  %s\n", #TEST);                  \
+        greatestpp_corpus *corpus = greatestpp_load_corpus(#TEST, PATH); \
+        size_t rec_i;                                                   \
+        for (rec_i = 0; rec_i < corpus->records.size(); rec_i++) {      \
+            const greatestpp_record *rec = &corpus->records[rec_i];     \
+            GREATESTPP_RUN_CALL(rec->name, TEST(rec));                  \
         }                                                               \
     } while (0)
-#endif
 
+/* Run CALL as the test NAME, either right away or, with -j N, queued
+ * for a worker thread; with -l, just list it. Queued tests copy their
+ * arguments, so anything passed by pointer must outlive the suite
+ * function. */
+#define GREATESTPP_RUN_CALL(NAME, CALL)                                 \
+    do {                                                                \
+        int run = greatestpp_pre_test(NAME);                            \
+        if (run == 1) {                                                 \
+            int res = CALL;                                             \
+            greatestpp_post_test(NAME, res);                            \
+        } else if (run == 2) {                                          \
+            greatestpp_queue_test(NAME, [=]() -> int { return CALL; }); \
+        } else if (run == 3) {                                          \
+            fprintf(GREATESTPP_STDOUT, "  %s\n", NAME);                 \
+        }                                                               \
+    } while (0)
 
-/* Check if the test runner is in verbose mode. */
-#define GREATESTPP_IS_VERBOSE() (greatestpp_info.flags & GREATESTPP_FLAG_VERBOSE)
-#define GREATESTPP_LIST_ONLY() (greatestpp_info.flags & GREATESTPP_FLAG_LIST_ONLY)
-#define GREATESTPP_FIRST_FAIL() (greatestpp_info.flags & GREATESTPP_FLAG_FIRST_FAIL)
-#define GREATESTPP_FAILURE_ABORT() (greatestpp_info.suite.failed > 0 && GREATESTPP_FIRST_FAIL())
-
-/* Message-less forms. */
-#define GREATESTPP_PASS() GREATESTPP_PASSm(NULL)
-#define GREATESTPP_FAIL() GREATESTPP_FAILm(NULL)
-#define GREATESTPP_SKIP() GREATESTPP_SKIPm(NULL)
-#define GREATESTPP_ASSERT(COND) GREATESTPP_ASSERTm(#COND, COND)
-#define GREATESTPP_ASSERT_FALSE(COND) GREATESTPP_ASSERT_FALSEm(#COND, COND)
-#define GREATESTPP_ASSERT_EQ(EXP, GOT) GREATESTPP_ASSERT_EQm(#EXP " != " #GOT, EXP, GOT)
-#define GREATESTPP_ASSERT_STR_EQ(EXP, GOT) GREATESTPP_ASSERT_STR_EQm(#EXP " != " #GOT, EXP, GOT)
+#if GREATESTPP_HAVE_ASYNC
+/* Start defining an async test, a coroutine returning the result with
+ * co_return. Use the CO_ forms of the assertions in it. */
+#define GREATESTPP_ASYNC_TEST static greatestpp_task
 
-/* The following forms take an additional message argument first,
- * to be displayed by the test runner. */
+/* Queue an async test in the current suite. They're run at the end of
+ * the suite, after the other tests, up to --async at a time on the main
+ * thread, each running until it waits on a file descriptor or timer. */
+#define GREATESTPP_RUN_ASYNC(TEST)                                      \
+    greatestpp_queue_async(#TEST, TEST)
 
-/* Fail if a condition is not true, with message. */
-#define GREATESTPP_ASSERTm(MSG, COND)                                     \
-    do {                                                                \
-        greatestpp_info.msg = MSG;                                        \
-        greatestpp_info.fail_file = __FILE__;                             \
-        greatestpp_info.fail_line = __LINE__;                             \
-        if (!(COND)) return -1;                                         \
-        greatestpp_info.msg = NULL;                                       \
-    } while (0)
+/* Suspend an async test until FD is readable or writable (or has an
+ * error or hangup), or for MS ms. Only one test may wait on an FD at a
+ * time. FDs that can't be polled, like regular files, count as ready. */
+#define GREATESTPP_AWAIT_READABLE(FD)                                   \
+    co_await greatestpp_fd_wait{(FD), EPOLLIN}
+#define GREATESTPP_AWAIT_WRITABLE(FD)                                   \
+    co_await greatestpp_fd_wait{(FD), EPOLLOUT}
+#define GREATESTPP_AWAIT_SLEEP(MS)                                      \
+    co_await greatestpp_sleep{greatestpp_now_ns() + (uint64_t)(MS) * 1000000}
 
-#define GREATESTPP_ASSERT_FALSEm(MSG, COND)                               \
+#define GREATESTPP_CO_PASSm(MSG)                                        \
     do {                                                                \
-        greatestpp_info.msg = MSG;                                        \
-        greatestpp_info.fail_file = __FILE__;                             \
-        greatestpp_info.fail_line = __LINE__;                             \
-        if ((COND)) return -1;                                          \
-        greatestpp_info.msg = NULL;                                       \
+        greatestpp_test.msg = MSG;                                      \
+        co_return 0;                                                    \
     } while (0)
-
-#define GREATESTPP_ASSERT_EQm(MSG, EXP, GOT)                              \
+#define GREATESTPP_CO_SKIPm(MSG)                                        \
     do {                                                                \
-        greatestpp_info.msg = MSG;                                        \
-        greatestpp_info.fail_file = __FILE__;                             \
-        greatestpp_info.fail_line = __LINE__;                             \
-        if ((EXP) != (GOT)) return -1;                                  \
-        greatestpp_info.msg = NULL;                                       \
+        greatestpp_test.msg = MSG;                                      \
+        co_return 1;                                                    \
     } while (0)
+#define GREATESTPP_CO_FAILm(MSG) GREATESTPP_FAIL_RETm(co_return, MSG)
+#define GREATESTPP_CO_PASS() GREATESTPP_CO_PASSm(NULL)
+#define GREATESTPP_CO_SKIP() GREATESTPP_CO_SKIPm(NULL)
+#define GREATESTPP_CO_FAIL() GREATESTPP_CO_FAILm(NULL)
+#define GREATESTPP_CO_ASSERTm(MSG, COND)                                \
+    GREATESTPP_ASSERT_RETm(co_return, MSG, COND)
+#define GREATESTPP_CO_ASSERT_FALSEm(MSG, COND)                          \
+    GREATESTPP_ASSERT_FALSE_RETm(co_return, MSG, COND)
+#define GREATESTPP_CO_ASSERT_EQm(MSG, EXP, GOT)                         \
+    GREATESTPP_ASSERT_EQ_RETm(co_return, MSG, EXP, GOT)
+#define GREATESTPP_CO_ASSERT_STR_EQm(MSG, EXP, GOT)                     \
+    GREATESTPP_ASSERT_STR_EQ_RETm(co_return, MSG, EXP, GOT)
+#define GREATESTPP_CO_ASSERT(COND) GREATESTPP_CO_ASSERTm(#COND, COND)
+#define GREATESTPP_CO_ASSERT_FALSE(COND)                                \
+    GREATESTPP_CO_ASSERT_FALSEm(#COND, COND)
+#define GREATESTPP_CO_ASSERT_EQ(EXP, GOT)                               \
+    GREATESTPP_CO_ASSERT_EQm(#EXP " != " #GOT, EXP, GOT)
+#define GREATESTPP_CO_ASSERT_STR_EQ(EXP, GOT)                           \
+    GREATESTPP_CO_ASSERT_STR_EQm(#EXP " != " #GOT, EXP, GOT)
+#endif
 
-#define GREATESTPP_ASSERT_STR_EQm(MSG, EXP, GOT)                          \
+/* Fail if the process's RSS has reached KB kB at any point since the
+ * test started, as for a service's memory limit. The peak is reset
+ * before each test once --memory-report or an ASSERT_RSS_UNDER is
+ * used, so a process's first ASSERT_RSS_UNDER without --memory-report
+ * checks the current RSS instead. Linux only; elsewhere it always
+ * passes. */
+#define GREATESTPP_ASSERT_RSS_UNDERm(MSG, KB)                           \
     do {                                                                \
-        const char *exp_s = (EXP);                                      \
-        const char *got_s = (GOT);                                      \
-        greatestpp_info.msg = MSG;                                        \
-        greatestpp_info.fail_file = __FILE__;                             \
-        greatestpp_info.fail_line = __LINE__;                             \
-        if (0 != strcmp(exp_s, got_s)) {                                \
-            fprintf(GREATESTPP_STDOUT,                                    \
-                "Expected:\n####\n%s\n####\n", exp_s);                  \
-            fprintf(GREATESTPP_STDOUT,                                    \
-                "Got:\n####\n%s\n####\n", got_s);                       \
+        if (greatestpp_check_rss(MSG, __FILE__, __LINE__,               \
+                (uint64_t)(KB)) < 0) {                                  \
             return -1;                                                  \
         }                                                               \
-        greatestpp_info.msg = NULL;                                       \
-    } while (0)
-        
-#define GREATESTPP_PASSm(MSG)                                             \
-    do {                                                                \
-        greatestpp_info.msg = MSG;                                        \
-        return 0;                                                       \
-    } while (0)
-        
-#define GREATESTPP_FAILm(MSG)                                             \
-    do {                                                                \
-        greatestpp_info.fail_file = __FILE__;                             \
-        greatestpp_info.fail_line = __LINE__;                             \
-        greatestpp_info.msg = MSG;                                        \
-        return -1;                                                      \
     } while (0)
 
-#define GREATESTPP_SKIPm(MSG)                                             \
+#define GREATESTPP_ASSERT_RSS_UNDER(KB)                                 \
+    GREATESTPP_ASSERT_RSS_UNDERm("peak RSS", KB)
+
+/* Start defining a stress test, which takes a greatestpp_stress *. */
+#define GREATESTPP_STRESS_TEST static int
+
+/* Run a stress test in the current suite, calling its body over and
+ * over on THREADS threads (0: one per CPU) at once, for --stress-time
+ * ms. The threads are released together, and all stop at the first
+ * failure. With -v, a pass reports the operations per second, and
+ * Jain's fairness index of the threads' rates (1: all equal). Each
+ * thread gets its own fixtures, so share what's under test through
+ * statics. */
+#define GREATESTPP_RUN_STRESS(TEST, THREADS)                            \
+    GREATESTPP_RUN_CALL(#TEST, greatestpp_run_stress(TEST, THREADS, 0))
+
+/* Run a stress test for ITERATIONS calls per thread instead. */
+#define GREATESTPP_RUN_STRESS_N(TEST, THREADS, ITERATIONS)              \
+    GREATESTPP_RUN_CALL(#TEST,                                          \
+        greatestpp_run_stress(TEST, THREADS, ITERATIONS))
+
+#if GREATESTPP_HAVE_AFFINITY
+/* Pin thread T to the Nth CPU this process may run on, wrapping. */
+inline void greatestpp_pin_thread(std::thread &t, unsigned int n) {
+    cpu_set_t allowed;
+    cpu_set_t one;
+    int cpu;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    n %= (unsigned int)CPU_COUNT(&allowed);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0) break;
+    }
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    pthread_setaffinity_np(t.native_handle(), sizeof(one), &one);
+}
+#else
+inline void greatestpp_pin_thread(std::thread &t, unsigned int n) {
+    (void)t;
+    (void)n;
+}
+#endif
+
+/* Run a benchmark in the current suite. Benchmarks only run with
+ * --bench, which skips the tests, and always run on the main thread. */
+#define GREATESTPP_RUN_BENCH(BENCH)                                     \
     do {                                                                \
-        greatestpp_info.msg = MSG;                                        \
-        return 1;                                                       \
+        if (greatestpp_pre_bench(#BENCH) == 1) {                        \
+            greatestpp_run_bench(#BENCH, BENCH);                        \
+        } else if (GREATESTPP_LIST_ONLY() && GREATESTPP_BENCH_MODE()) { \
+            fprintf(GREATESTPP_STDOUT, "  %s\n", #BENCH);               \
+        }                                                               \
     } while (0)
 
-#define GREATESTPP_SET_TIME(NAME)                                         \
-    NAME = clock();                                                     \
-    if (NAME == (clock_t) -1) {                                         \
-        fprintf(GREATESTPP_STDOUT,                                        \
-            "clock error: %s\n", #NAME);                                \
-        exit(EXIT_FAILURE);                                             \
-    }
+/* Keep the compiler from optimizing away VALUE, or the writes to
+ * memory made so far, inside a benchmark's loop. */
+#define GREATESTPP_DO_NOT_OPTIMIZE(VALUE) greatestpp_do_not_optimize(VALUE)
+#define GREATESTPP_CLOBBER_MEMORY() greatestpp_clobber_memory()
 
-#define GREATESTPP_CLOCK_DIFF(C1, C2)                                     \
-    fprintf(GREATESTPP_STDOUT, " (%lu ticks, %.3f sec)",                  \
-        (long unsigned int) (C2) - (C1),                                \
-        (double)((C2) - (C1)) / (1.0 * (double)CLOCKS_PER_SEC))         \
+#if defined(__GNUC__)
+template <typename T>
+inline void greatestpp_do_not_optimize(T const &value) {
+    __asm__ __volatile__("" : : "r,m"(value) : "memory");
+}
 
-/* Include several function definitions in the main test file. */
-#define GREATESTPP_MAIN_DEFS()                                            \
-                                                                        \
-/* Is FILTER a subset of NAME? */                                       \
-static int greatestpp_name_match(const char *name,                        \
-    const char *filter) {                                               \
-    size_t offset = 0;                                                  \
-    size_t filter_len = strlen(filter);                                 \
-    while (name[offset] != '\0') {                                      \
-        if (name[offset] == filter[0]) {                                \
-            if (0 == strncmp(&name[offset], filter, filter_len)) {      \
-                return 1;                                               \
-            }                                                           \
-        }                                                               \
-        offset++;                                                       \
-    }                                                                   \
-                                                                        \
-    return 0;                                                           \
-}                                                                       \
-                                                                        \
-int greatestpp_pre_test(const char *name) {                               \
-    if (!GREATESTPP_LIST_ONLY()                                           \
-        && (!GREATESTPP_FIRST_FAIL() || greatestpp_info.suite.failed == 0)  \
-        && (greatestpp_info.test_filter == NULL ||                        \
-            greatestpp_name_match(name, greatestpp_info.test_filter))) {    \
-        GREATESTPP_SET_TIME(greatestpp_info.suite.pre_test);                \
-        if (greatestpp_info.setup) {                                      \
-            greatestpp_info.setup(greatestpp_info.setup_udata);             \
-        }                                                               \
-        return 1;               /* test should be run */                \
-    } else {                                                            \
-        return 0;               /* skipped */                           \
-    }                                                                   \
-}                                                                       \
+inline void greatestpp_clobber_memory(void) {
+    __asm__ __volatile__("" : : : "memory");
+}
+#else
+template <typename T>
+inline void greatestpp_do_not_optimize(T const &value) {
+    static const void *volatile sink;
+    sink = &value;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+inline void greatestpp_clobber_memory(void) {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+#endif
+
+/* Get this thread's instance of fixture type T, default-constructing
+ * it on first use. A fixture only used by filtered-out tests is never
+ * built. Suite fixtures are destroyed before the suite ends, by the
+ * thread that built them; global ones when the thread exits. -p
+ * workers each build their own, once per suite. */
+#define GREATESTPP_SUITE_FIXTURE(T)                                     \
+    greatestpp_fixture<T>(GREATESTPP_SCOPE_SUITE)
+#define GREATESTPP_GLOBAL_FIXTURE(T)                                    \
+    greatestpp_fixture<T>(GREATESTPP_SCOPE_GLOBAL)
+
+template <typename T>
+struct greatestpp_fixture_id {
+    static const char id;
+};
+
+template <typename T>
+const char greatestpp_fixture_id<T>::id = 0;
+
+template <typename T>
+void greatestpp_fixture_destroy(void *instance) {
+    delete (T *)instance;
+}
+
+template <typename T>
+T &greatestpp_fixture(GREATESTPP_SCOPE scope) {
+    greatestpp_fixture_set *set = &greatestpp_fixtures;
+    greatestpp_fixture_slot slot;
+    for (size_t i = 0; i < set->slots.size(); i++) {
+        if (set->slots[i].type == &greatestpp_fixture_id<T>::id
+            && set->slots[i].scope == scope) {
+            return *(T *)set->slots[i].instance;
+        }
+    }
+    slot.type = &greatestpp_fixture_id<T>::id;
+    slot.scope = scope;
+    slot.instance = new T();
+    slot.destroy = greatestpp_fixture_destroy<T>;
+    set->slots.push_back(slot);
+    return *(T *)slot.instance;
+}
+
+/* Append VALUE to OUT, formatted by its type, for a failure message. */
+inline void greatestpp_format_chars(std::string &out, const char *data,
+                                    size_t size, char quote) {
+    char buf[8];
+    size_t i;
+    if (data == NULL) {
+        out += "NULL";
+        return;
+    }
+    out += quote;
+    for (i = 0; i < size; i++) {
+        unsigned char c = (unsigned char)data[i];
+        switch (c) {
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c == (unsigned char)quote) {
+                out += '\\';
+                out += quote;
+            } else if (c < 0x20 || c >= 0x7f) {
+                snprintf(buf, sizeof(buf), "\\x%02x", c);
+                out += buf;
+            } else {
+                out += (char)c;
+            }
+            break;
+        }
+    }
+    out += quote;
+}
+
+inline void greatestpp_format(std::string &out, bool value) {
+    out += value ? "true" : "false";
+}
+
+inline void greatestpp_format(std::string &out, char value) {
+    greatestpp_format_chars(out, &value, 1, '\'');
+}
+
+inline void greatestpp_format(std::string &out, const char *value) {
+    greatestpp_format_chars(out, value, value ? strlen(value) : 0, '"');
+}
+
+inline void greatestpp_format(std::string &out, char *value) {
+    greatestpp_format(out, (const char *)value);
+}
+
+inline void greatestpp_format(std::string &out, const std::string &value) {
+    greatestpp_format_chars(out, value.data(), value.size(), '"');
+}
+
+inline void greatestpp_format(std::string &out, greatestpp_slice value) {
+    greatestpp_format_chars(out, value.data, value.size, '"');
+}
+
+#if __cplusplus >= 201703L
+inline void greatestpp_format(std::string &out, std::string_view value) {
+    greatestpp_format_chars(out, value.data(), value.size(), '"');
+}
+#endif
+
+inline void greatestpp_format(std::string &out, std::nullptr_t) {
+    out += "nullptr";
+}
+
+/* Other types, picked by the most specific rank that applies. */
+struct greatestpp_rank0 {};
+struct greatestpp_rank1 : greatestpp_rank0 {};
+struct greatestpp_rank2 : greatestpp_rank1 {};
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value
+    && std::is_signed<T>::value>::type
+greatestpp_format_any(std::string &out, const T &value, greatestpp_rank2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", (long long)value);
+    out += buf;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value
+    && std::is_unsigned<T>::value>::type
+greatestpp_format_any(std::string &out, const T &value, greatestpp_rank2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+    out += buf;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+greatestpp_format_any(std::string &out, const T &value, greatestpp_rank2) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*Lg",
+        std::numeric_limits<T>::max_digits10, (long double)value);
+    out += buf;
+}
+
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value>::type
+greatestpp_format_any(std::string &out, const T &value, greatestpp_rank2) {
+    typedef typename std::underlying_type<T>::type int_type;
+    greatestpp_format_any(out, (int_type)value, greatestpp_rank2());
+}
+
+template <typename T>
+typename std::enable_if<std::is_pointer<T>::value
+    && !std::is_function<typename std::remove_pointer<T>::type>::value>::type
+greatestpp_format_any(std::string &out, const T &value, greatestpp_rank2) {
+    char buf[32];
+    if (value == NULL) {
+        out += "NULL";
+        return;
+    }
+    snprintf(buf, sizeof(buf), "%p", (const void *)value);
+    out += buf;
+}
+
+/* Anything else with an operator<<. */
+template <typename T>
+auto greatestpp_format_any(std::string &out, const T &value, greatestpp_rank1)
+    -> decltype(std::declval<std::ostream &>() << value, void()) {
+    std::ostringstream s;
+    s << value;
+    out += s.str();
+}
+
+/* And the rest. */
+template <typename T>
+void greatestpp_format_any(std::string &out, const T &, greatestpp_rank0) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "(%lu-byte object)", (unsigned long)sizeof(T));
+    out += buf;
+}
+
+template <typename T>
+void greatestpp_format(std::string &out, const T &value) {
+    greatestpp_format_any(out, value, greatestpp_rank2());
+}
+
+/* ASSERT_EQ's comparison. Lets NULL, an integer on most compilers,
+ * be compared with pointers as it could before the operands were
+ * bound to references. */
+template <typename E, typename G>
+bool greatestpp_ne(const E &exp, const G &got) {
+    return exp != got;
+}
+
+template <typename I, typename T>
+typename std::enable_if<std::is_integral<I>::value, bool>::type
+greatestpp_ne(const I &exp, T *const &got) {
+    return exp != 0 || got != NULL;
+}
+
+template <typename T, typename I>
+typename std::enable_if<std::is_integral<I>::value, bool>::type
+greatestpp_ne(T *const &exp, const I &got) {
+    return exp != NULL || got != 0;
+}
+
+/* ASSERT_STR_EQ's operands, as bytes and a length. */
+inline greatestpp_slice greatestpp_str(const char *s) {
+    greatestpp_slice slice = { s, s ? strlen(s) : 0 };
+    return slice;
+}
+
+inline greatestpp_slice greatestpp_str(const std::string &s) {
+    greatestpp_slice slice = { s.data(), s.size() };
+    return slice;
+}
+
+inline greatestpp_slice greatestpp_str(greatestpp_slice s) {
+    return s;
+}
+
+#if __cplusplus >= 201703L
+inline greatestpp_slice greatestpp_str(std::string_view s) {
+    greatestpp_slice slice = { s.data(), s.size() };
+    return slice;
+}
+#endif
+
+inline bool greatestpp_str_eq(greatestpp_slice a, greatestpp_slice b) {
+    if (a.data == NULL || b.data == NULL) return a.data == b.data;
+    return a.size == b.size && 0 == memcmp(a.data, b.data, a.size);
+}
+
+/* Record a failed comparison and the values that were compared. */
+template <typename E, typename G>
+GREATESTPP_COLD void greatestpp_fail_eq(const char *msg, const char *file,
+        unsigned int line, const E &exp, const G &got) {
+    std::string &out = greatestpp_fail_msg;
+    out.clear();
+    if (msg) {
+        out += msg;
+        out += ": ";
+    }
+    out += "expected ";
+    greatestpp_format(out, exp);
+    out += ", got ";
+    greatestpp_format(out, got);
+    greatestpp_fail_at(out.c_str(), file, line);
+}
+
+/* Monotonic time for the latency assertions. Cheaper than
+ * greatestpp_get_time(), which also reads a CPU clock. */
+inline uint64_t greatestpp_now_ns(void) {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* A greatestpp_sample_cb for callables of type F, so the timed loop
+ * calls FN directly. */
+template <typename F>
+void greatestpp_sample_calls(void *fn, uint64_t batch, double *ns, size_t n) {
+    F &f = *(F *)fn;
+    size_t i;
+    uint64_t j;
+    for (i = 0; i < n; i++) {
+        uint64_t start = greatestpp_now_ns();
+        for (j = 0; j < batch; j++) f();
+        ns[i] = (double)(greatestpp_now_ns() - start) / (double)batch;
+    }
+}
+
+#if GREATESTPP_HAVE_ASYNC
+/* Resumes the coroutine that co_awaited a finished greatestpp_task. */
+struct greatestpp_final_awaiter {
+    std::coroutine_handle<> caller;
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<>) noexcept {
+        return caller ? caller : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+};
+
+/* The coroutine an ASYNC_TEST returns. It starts suspended, and its
+ * co_return value is the result, as for TEST. A test can co_await
+ * other greatestpp_tasks as helpers, and get their results. */
+struct greatestpp_task {
+    struct promise_type {
+        int res = 0;
+        std::coroutine_handle<> caller;
+
+        greatestpp_task get_return_object() {
+            return greatestpp_task(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        greatestpp_final_awaiter final_suspend() noexcept {
+            return greatestpp_final_awaiter{caller};
+        }
+        void return_value(int r) { res = r; }
+        void unhandled_exception() {
+            res = -1;
+            greatestpp_fail_at("uncaught exception", NULL, 0);
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+
+    greatestpp_task() : handle(nullptr) {}
+    explicit greatestpp_task(std::coroutine_handle<promise_type> h)
+        : handle(h) {}
+    greatestpp_task(greatestpp_task &&other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+    greatestpp_task &operator=(greatestpp_task &&other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    greatestpp_task(const greatestpp_task &) = delete;
+    greatestpp_task &operator=(const greatestpp_task &) = delete;
+    ~greatestpp_task() {
+        if (handle) handle.destroy();
+    }
+
+    /* co_await a helper: run it, then resume here with its result. */
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+        handle.promise().caller = caller;
+        return handle;
+    }
+    int await_resume() const { return handle.promise().res; }
+};
+
+/* Called from the awaitables below: suspend the running async test
+ * until FD is ready, or until the steady clock reaches DUE_NS. */
+bool greatestpp_async_wait_fd(int fd, uint32_t events,
+                              std::coroutine_handle<> h);
+void greatestpp_async_wait_until(uint64_t due_ns, std::coroutine_handle<> h);
+void greatestpp_queue_async(const char *name,
+                            std::function<greatestpp_task(void)> start);
+
+struct greatestpp_fd_wait {
+    int fd;
+    uint32_t events;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        return greatestpp_async_wait_fd(fd, events, h);
+    }
+    void await_resume() const noexcept {}
+};
+
+struct greatestpp_sleep {
+    uint64_t due_ns;
+    bool await_ready() const noexcept {
+        return greatestpp_now_ns() >= due_ns;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        greatestpp_async_wait_until(due_ns, h);
+    }
+    void await_resume() const noexcept {}
+};
+
+/* An async test queued by RUN_ASYNC, with the callbacks it was queued
+ * with, and its state on the loop. */
+typedef enum {
+    GREATESTPP_ASYNC_QUEUED,
+    GREATESTPP_ASYNC_RUNNING,
+    GREATESTPP_ASYNC_DONE
+} GREATESTPP_ASYNC_STATE;
+
+typedef struct greatestpp_async_test {
+    const char *name;
+    std::function<greatestpp_task(void)> start;
+    greatestpp_setup_cb *setup;
+    void *setup_udata;
+    greatestpp_teardown_cb *teardown;
+    void *teardown_udata;
+    unsigned int timeout_ms;    /* 0 for no timeout */
+
+    GREATESTPP_ASYNC_STATE state;
+    greatestpp_task task;
+    std::coroutine_handle<> waiting; /* the coroutine to resume */
+    int fd;                     /* waited on, or -1 */
+    int wait_error;             /* errno of a failed wait on an FD */
+    uint64_t wake_ns;           /* end of a sleep, or 0 */
+    uint64_t deadline_ns;       /* for the timeout, or 0 */
+
+    int res;
+    greatestpp_test_info info;  /* swapped in while it runs */
+    greatestpp_time pre_test;
+    greatestpp_time post_test;
+    uint64_t cpu_ns;            /* over its own resumptions */
+    std::string msg_buf;
+} greatestpp_async_test;
+
+/* The current suite's async tests, and the loop running them. */
+typedef struct greatestpp_async_loop {
+    int epfd;                   /* -1 until the first async test runs */
+    std::vector<greatestpp_async_test> tests;
+    size_t current;             /* index of the test being resumed */
+    unsigned int running;
+    unsigned int failed;
+} greatestpp_async_loop;
+
+extern greatestpp_async_loop greatestpp_async;
+#endif
+
+
+/* Check if the test runner is in verbose mode. */
+#define GREATESTPP_IS_VERBOSE() (greatestpp_info.flags & GREATESTPP_FLAG_VERBOSE)
+#define GREATESTPP_LIST_ONLY() (greatestpp_info.flags & GREATESTPP_FLAG_LIST_ONLY)
+#define GREATESTPP_FIRST_FAIL() (greatestpp_info.flags & GREATESTPP_FLAG_FIRST_FAIL)
+#define GREATESTPP_BENCH_MODE() (greatestpp_info.flags & GREATESTPP_FLAG_BENCH)
+#define GREATESTPP_REORDER() (greatestpp_info.flags                     \
+    & (GREATESTPP_FLAG_FAILED_FIRST | GREATESTPP_FLAG_ORDER_DURATION))
+#define GREATESTPP_FAILURE_ABORT() (greatestpp_info.suite.failed > 0 && GREATESTPP_FIRST_FAIL())
+
+/* Message-less forms. */
+#define GREATESTPP_PASS() GREATESTPP_PASSm(NULL)
+#define GREATESTPP_FAIL() GREATESTPP_FAILm(NULL)
+#define GREATESTPP_SKIP() GREATESTPP_SKIPm(NULL)
+#define GREATESTPP_ASSERT(COND) GREATESTPP_ASSERTm(#COND, COND)
+#define GREATESTPP_ASSERT_FALSE(COND) GREATESTPP_ASSERT_FALSEm(#COND, COND)
+#define GREATESTPP_ASSERT_EQ(EXP, GOT) GREATESTPP_ASSERT_EQm(#EXP " != " #GOT, EXP, GOT)
+#define GREATESTPP_ASSERT_STR_EQ(EXP, GOT) GREATESTPP_ASSERT_STR_EQm(#EXP " != " #GOT, EXP, GOT)
+
+/* The following forms take an additional message argument first,
+ * to be displayed by the test runner. The _RETm forms also take the
+ * statement that ends the test, return or co_return. */
+
+/* Fail if a condition is not true, with message. Nothing but the
+ * condition is evaluated unless it fails. */
+#define GREATESTPP_ASSERT_RETm(RET, MSG, COND)                          \
+    do {                                                                \
+        if (GREATESTPP_UNLIKELY(!(COND))) {                             \
+            greatestpp_fail_at(MSG, __FILE__, __LINE__);                \
+            RET -1;                                                     \
+        }                                                               \
+    } while (0)
+#define GREATESTPP_ASSERTm(MSG, COND)                                   \
+    GREATESTPP_ASSERT_RETm(return, MSG, COND)
+
+#define GREATESTPP_ASSERT_FALSE_RETm(RET, MSG, COND)                    \
+    do {                                                                \
+        if (GREATESTPP_UNLIKELY((COND))) {                              \
+            greatestpp_fail_at(MSG, __FILE__, __LINE__);                \
+            RET -1;                                                     \
+        }                                                               \
+    } while (0)
+#define GREATESTPP_ASSERT_FALSEm(MSG, COND)                             \
+    GREATESTPP_ASSERT_FALSE_RETm(return, MSG, COND)
+
+/* Fail if EXP != GOT, printing both. Each is evaluated once. */
+#define GREATESTPP_ASSERT_EQ_RETm(RET, MSG, EXP, GOT)                   \
+    do {                                                                \
+        GREATESTPP_NULL_OK_BEGIN                                        \
+        const auto &greatestpp_exp = (EXP);                             \
+        const auto &greatestpp_got = (GOT);                             \
+        GREATESTPP_NULL_OK_END                                          \
+        if (GREATESTPP_UNLIKELY(                                        \
+                greatestpp_ne(greatestpp_exp, greatestpp_got))) {       \
+            greatestpp_fail_eq(MSG, __FILE__, __LINE__,                 \
+                greatestpp_exp, greatestpp_got);                        \
+            RET -1;                                                     \
+        }                                                               \
+    } while (0)
+#define GREATESTPP_ASSERT_EQm(MSG, EXP, GOT)                            \
+    GREATESTPP_ASSERT_EQ_RETm(return, MSG, EXP, GOT)
+
+/* Fail unless two strings have the same bytes. Each may be a C
+ * string, a std::string, a std::string_view or a greatestpp_slice. */
+#define GREATESTPP_ASSERT_STR_EQ_RETm(RET, MSG, EXP, GOT)               \
+    do {                                                                \
+        const auto &greatestpp_exp = (EXP);                             \
+        const auto &greatestpp_got = (GOT);                             \
+        if (GREATESTPP_UNLIKELY(                                        \
+                !greatestpp_str_eq(greatestpp_str(greatestpp_exp),      \
+                    greatestpp_str(greatestpp_got)))) {                 \
+            greatestpp_fail_eq(MSG, __FILE__, __LINE__,                 \
+                greatestpp_str(greatestpp_exp),                         \
+                greatestpp_str(greatestpp_got));                        \
+            RET -1;                                                     \
+        }                                                               \
+    } while (0)
+#define GREATESTPP_ASSERT_STR_EQm(MSG, EXP, GOT)                        \
+    GREATESTPP_ASSERT_STR_EQ_RETm(return, MSG, EXP, GOT)
+
+#define GREATESTPP_PASSm(MSG)                                             \
+    do {                                                                \
+        greatestpp_test.msg = MSG;                                        \
+        return 0;                                                       \
+    } while (0)
+        
+#define GREATESTPP_FAIL_RETm(RET, MSG)                                  \
+    do {                                                                \
+        greatestpp_fail_at(MSG, __FILE__, __LINE__);                    \
+        RET -1;                                                         \
+    } while (0)
+#define GREATESTPP_FAILm(MSG) GREATESTPP_FAIL_RETm(return, MSG)
+
+#ifdef GREATESTPP_TRACK_ALLOCS
+/* Fail if evaluating EXPR allocates more than N blocks. */
+#define GREATESTPP_ASSERT_MAX_ALLOCSm(MSG, N, EXPR)                     \
+    do {                                                                \
+        uint64_t greatestpp_allocs_before =                             \
+            greatestpp_alloc_tls.stats.allocs;                          \
+        (void)(EXPR);                                                   \
+        if (greatestpp_alloc_tls.stats.allocs - greatestpp_allocs_before \
+                > (uint64_t)(N)) {                                      \
+            greatestpp_fail_at(MSG, __FILE__, __LINE__);                \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+#define GREATESTPP_ASSERT_MAX_ALLOCS(N, EXPR)                           \
+    GREATESTPP_ASSERT_MAX_ALLOCSm(#EXPR " allocated more than " #N,     \
+        N, EXPR)
+#define GREATESTPP_ASSERT_NO_ALLOC(EXPR)                                \
+    GREATESTPP_ASSERT_MAX_ALLOCSm(#EXPR " allocated", 0, EXPR)
+
+/* Start and stop counting this thread's allocations for a test. */
+#define GREATESTPP_ALLOC_BEGIN()                                        \
+    do {                                                                \
+        memset(&greatestpp_alloc_tls.stats, 0,                          \
+            sizeof(greatestpp_alloc_tls.stats));                        \
+        greatestpp_alloc_tls.active = 1;                                \
+    } while (0)
+#define GREATESTPP_ALLOC_END(STATS)                                     \
+    do {                                                                \
+        greatestpp_alloc_tls.active = 0;                                \
+        (STATS) = greatestpp_alloc_tls.stats;                           \
+    } while (0)
+#else
+#define GREATESTPP_ALLOC_BEGIN() do {} while (0)
+#define GREATESTPP_ALLOC_END(STATS) do {} while (0)
+#endif
+
+/* Fail unless 99% of calls to FN, a callable taking no arguments,
+ * take under NS ns. FN is warmed up first, and timed again with more
+ * samples, up to GREATESTPP_LATENCY_ATTEMPTS times, before failing. */
+#define GREATESTPP_ASSERT_P99_UNDERm(MSG, NS, FN)                       \
+    do {                                                                \
+        auto greatestpp_fn = (FN);                                      \
+        if (greatestpp_check_p99(MSG, __FILE__, __LINE__, (double)(NS), \
+                greatestpp_sample_calls<decltype(greatestpp_fn)>,       \
+                &greatestpp_fn) < 0) {                                  \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+/* Fail unless the median call to FAST is at least RATIO times as fast
+ * as the median call to SLOW. Calls to the two are interleaved, so
+ * drifting clock speeds affect both. */
+#define GREATESTPP_ASSERT_FASTER_THANm(MSG, RATIO, FAST, SLOW)          \
+    do {                                                                \
+        auto greatestpp_fast = (FAST);                                  \
+        auto greatestpp_slow = (SLOW);                                  \
+        if (greatestpp_check_faster(MSG, __FILE__, __LINE__,            \
+                (double)(RATIO),                                        \
+                greatestpp_sample_calls<decltype(greatestpp_fast)>,     \
+                &greatestpp_fast,                                       \
+                greatestpp_sample_calls<decltype(greatestpp_slow)>,     \
+                &greatestpp_slow) < 0) {                                \
+            return -1;                                                  \
+        }                                                               \
+    } while (0)
+
+#define GREATESTPP_ASSERT_P99_UNDER(NS, FN)                             \
+    GREATESTPP_ASSERT_P99_UNDERm(#FN, NS, FN)
+#define GREATESTPP_ASSERT_FASTER_THAN(RATIO, FAST, SLOW)                \
+    GREATESTPP_ASSERT_FASTER_THANm(#FAST " vs " #SLOW, RATIO, FAST, SLOW)
+
+#define GREATESTPP_SKIPm(MSG)                                             \
+    do {                                                                \
+        greatestpp_test.msg = MSG;                                        \
+        return 1;                                                       \
+    } while (0)
+
+/* Record the time in NAME, with the CPU time used by this thread. */
+#define GREATESTPP_SET_TIME(NAME)                                         \
+    if (!greatestpp_get_time(&(NAME), 0)) {                             \
+        fprintf(GREATESTPP_STDOUT,                                        \
+            "clock error: %s\n", #NAME);                                \
+        exit(EXIT_FAILURE);                                             \
+    }
+
+/* Same, but with the CPU time used by the whole process. */
+#define GREATESTPP_SET_PROCESS_TIME(NAME)                               \
+    if (!greatestpp_get_time(&(NAME), 1)) {                             \
+        fprintf(GREATESTPP_STDOUT,                                      \
+            "clock error: %s\n", #NAME);                                \
+        exit(EXIT_FAILURE);                                             \
+    }
+
+#define GREATESTPP_CLOCK_DIFF(C1, C2)                                     \
+    fprintf(GREATESTPP_STDOUT, " (%.3f ms, %.3f ms cpu)",               \
+        (double)((C2).wall_ns - (C1).wall_ns) / 1e6,                    \
+        (double)((C2).cpu_ns - (C1).cpu_ns) / 1e6)
+
+#if defined(CLOCK_MONOTONIC) && defined(CLOCK_THREAD_CPUTIME_ID)
+/* Read the clocks with clock_gettime(). */
+#define GREATESTPP_TIME_DEFS()                                          \
+int greatestpp_get_time(greatestpp_time *t, int process) {              \
+    struct timespec ts;                                                 \
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) return 0;             \
+    t->wall_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec; \
+    if (clock_gettime(process ? CLOCK_PROCESS_CPUTIME_ID                \
+            : CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {                     \
+        return 0;                                                       \
+    }                                                                   \
+    t->cpu_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec; \
+    return 1;                                                           \
+}
+#else
+/* Fall back on std::chrono and clock(), which only has process CPU
+ * time, and often at a coarse resolution. */
+#define GREATESTPP_TIME_DEFS()                                          \
+int greatestpp_get_time(greatestpp_time *t, int process) {              \
+    clock_t cpu = clock();                                              \
+    (void)process;                                                      \
+    if (cpu == (clock_t)-1) return 0;                                   \
+    t->wall_ns = (uint64_t)std::chrono::duration_cast<                  \
+        std::chrono::nanoseconds>(                                      \
+        std::chrono::steady_clock::now().time_since_epoch()).count();   \
+    t->cpu_ns = (uint64_t)((double)cpu * 1e9 / CLOCKS_PER_SEC);         \
+    return 1;                                                           \
+}
+#endif
+
+#if GREATESTPP_HAVE_FORK
+/* Definitions for running queued tests in forked worker processes
+ * (-p N). A test that crashes only takes down its worker: the test is
+ * reported as a failure and a new worker takes its place. Workers are
+ * forked from the runner after it's initialized, so they share its
+ * memory copy-on-write; with --fork-batch, each is replaced by a fresh
+ * fork after that many tests, isolating them at the cost of a fork. */
+#define GREATESTPP_FORK_DEFS()                                          \
+                                                                        \
+/* Read or write exactly LEN bytes. Returns 0 on EOF or error. */       \
+static int greatestpp_fd_read(int fd, void *buf, size_t len) {          \
+    char *p = (char *)buf;                                              \
+    while (len > 0) {                                                   \
+        ssize_t n = read(fd, p, len);                                   \
+        if (n < 0 && errno == EINTR) continue;                          \
+        if (n <= 0) return 0;                                           \
+        p += n;                                                         \
+        len -= (size_t)n;                                               \
+    }                                                                   \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+static int greatestpp_fd_write(int fd, const void *buf, size_t len) {   \
+    const char *p = (const char *)buf;                                  \
+    while (len > 0) {                                                   \
+        ssize_t n = write(fd, p, len);                                  \
+        if (n < 0 && errno == EINTR) continue;                          \
+        if (n <= 0) return 0;                                           \
+        p += n;                                                         \
+        len -= (size_t)n;                                               \
+    }                                                                   \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+/* Main loop of a forked worker: run each job index the parent sends    \
+ * and send back its result, until the parent closes the pipe. */       \
+static void greatestpp_fork_child(int cmd_fd, int res_fd) {             \
+    uint64_t index;                                                     \
+    greatestpp_perf_reset();                                            \
+    while (greatestpp_fd_read(cmd_fd, &index, sizeof(index))) {         \
+        greatestpp_job *job = &greatestpp_workers.jobs[index];          \
+        greatestpp_fork_record rec;                                     \
+        const char *msg;                                                \
+        const char *file;                                               \
+        greatestpp_run_job((size_t)index);                              \
+        fflush(GREATESTPP_STDOUT);                                      \
+        msg = job->info.msg;                                            \
+        file = job->info.fail_file;                                     \
+        rec.index = index;                                              \
+        rec.res = job->res;                                             \
+        rec.fail_line = job->info.fail_line;                            \
+        rec.msg_len = msg ? (uint32_t)strlen(msg) : UINT32_MAX;         \
+        rec.file_len = file ? (uint32_t)strlen(file) : UINT32_MAX;      \
+        rec.pre_test = job->pre_test;                                   \
+        rec.post_test = job->post_test;                                 \
+        rec.allocs = job->info.allocs;                                  \
+        rec.perf = job->info.perf;                                      \
+        rec.mem = job->info.mem;                                        \
+        if (!greatestpp_fd_write(res_fd, &rec, sizeof(rec))             \
+            || (msg && !greatestpp_fd_write(res_fd, msg, rec.msg_len))  \
+            || (file && !greatestpp_fd_write(res_fd, file, rec.file_len))) { \
+            break;                                                      \
+        }                                                               \
+    }                                                                   \
+    /* _exit skips thread_local destructors, so release the fixtures    \
+     * this worker built first. */                                      \
+    greatestpp_release_fixtures(GREATESTPP_SCOPE_GLOBAL);               \
+    _exit(EXIT_SUCCESS);                                                \
+}                                                                       \
+                                                                        \
+static void greatestpp_fork_spawn(std::vector<greatestpp_fork_worker> &workers, \
+                                  size_t slot) {                        \
+    greatestpp_fork_worker *w = &workers[slot];                         \
+    int cmd[2];                                                         \
+    int res[2];                                                         \
+    size_t i;                                                           \
+    if (pipe(cmd) != 0 || pipe(res) != 0) {                             \
+        perror("pipe");                                                 \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    fflush(GREATESTPP_STDOUT);                                          \
+    w->pid = fork();                                                    \
+    if (w->pid == -1) {                                                 \
+        perror("fork");                                                 \
+        exit(EXIT_FAILURE);                                             \
+    } else if (w->pid == 0) {                                           \
+        /* Drop the other workers' pipes, so their EOFs still work. */  \
+        for (i = 0; i < workers.size(); i++) {                          \
+            if (i == slot || workers[i].pid <= 0) continue;             \
+            close(workers[i].cmd_fd);                                   \
+            close(workers[i].res_fd);                                   \
+        }                                                               \
+        close(cmd[1]);                                                  \
+        close(res[0]);                                                  \
+        greatestpp_fork_child(cmd[0], res[1]);                          \
+    }                                                                   \
+    close(cmd[0]);                                                      \
+    close(res[1]);                                                      \
+    w->cmd_fd = cmd[1];                                                 \
+    w->res_fd = res[0];                                                 \
+    w->job = SIZE_MAX;                                                  \
+    w->jobs_run = 0;                                                    \
+}                                                                       \
+                                                                        \
+/* Reap a worker that closed its pipe early or was killed, failing its  \
+ * test with REASON, or with how the worker died if REASON is NULL. */  \
+static void greatestpp_fork_reap(greatestpp_fork_worker *w,             \
+                                 const char *reason) {                  \
+    int status = 0;                                                     \
+    char buf[64];                                                       \
+    close(w->cmd_fd);                                                   \
+    close(w->res_fd);                                                   \
+    while (waitpid(w->pid, &status, 0) == -1 && errno == EINTR) {}      \
+    w->pid = 0;                                                         \
+    if (w->job == SIZE_MAX) return;                                     \
+    greatestpp_job *job = &greatestpp_workers.jobs[w->job];             \
+    if (reason) {                                                       \
+        snprintf(buf, sizeof(buf), "%s", reason);                       \
+    } else if (WIFSIGNALED(status)) {                                   \
+        snprintf(buf, sizeof(buf), "worker crashed (signal %d)",        \
+            WTERMSIG(status));                                          \
+    } else {                                                            \
+        snprintf(buf, sizeof(buf), "worker exited (status %d)",         \
+            WEXITSTATUS(status));                                       \
+    }                                                                   \
+    job->msg_buf = buf;                                                 \
+    job->info.msg = job->msg_buf.c_str();                               \
+    job->info.fail_file = NULL;                                         \
+    job->info.fail_line = 0;                                            \
+    job->pre_test = w->started;                                         \
+    GREATESTPP_SET_TIME(job->post_test);                                \
+    job->post_test.cpu_ns = w->started.cpu_ns;     /* unknown */        \
+    job->res = -1;                                                      \
+    job->ran = 1;                                                       \
+    if (GREATESTPP_FIRST_FAIL() && w->job < greatestpp_workers.first_fail) { \
+        greatestpp_workers.first_fail = w->job;                         \
+    }                                                                   \
+    w->job = SIZE_MAX;                                                  \
+}                                                                       \
+                                                                        \
+/* Read a worker's result for its current job. Returns 0 if the         \
+ * worker died instead. */                                              \
+static int greatestpp_fork_receive(greatestpp_fork_worker *w) {         \
+    greatestpp_job *job = &greatestpp_workers.jobs[w->job];             \
+    greatestpp_fork_record rec;                                         \
+    if (!greatestpp_fd_read(w->res_fd, &rec, sizeof(rec))) return 0;    \
+    job->msg_buf.resize(rec.msg_len == UINT32_MAX ? 0 : rec.msg_len);   \
+    job->file_buf.resize(rec.file_len == UINT32_MAX ? 0 : rec.file_len); \
+    if (!greatestpp_fd_read(w->res_fd, &job->msg_buf[0],                \
+            job->msg_buf.size())                                        \
+        || !greatestpp_fd_read(w->res_fd, &job->file_buf[0],            \
+            job->file_buf.size())) {                                    \
+        return 0;                                                       \
+    }                                                                   \
+    job->res = rec.res;                                                 \
+    job->info.msg = rec.msg_len == UINT32_MAX ? NULL : job->msg_buf.c_str(); \
+    job->info.fail_file =                                               \
+        rec.file_len == UINT32_MAX ? NULL : job->file_buf.c_str();      \
+    job->info.fail_line = rec.fail_line;                                \
+    job->pre_test = rec.pre_test;                                       \
+    job->post_test = rec.post_test;                                     \
+    job->info.allocs = rec.allocs;                                      \
+    job->info.perf = rec.perf;                                          \
+    job->info.mem = rec.mem;                                            \
+    job->ran = 1;                                                       \
+    if (job->res < 0 && GREATESTPP_FIRST_FAIL()                         \
+        && w->job < greatestpp_workers.first_fail) {                    \
+        greatestpp_workers.first_fail = w->job;                         \
+    }                                                                   \
+    w->job = SIZE_MAX;                                                  \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+/* Run the current suite's queued tests in forked worker processes.     \
+ * Idle workers are handed the next job index over their pipe. */       \
+static void greatestpp_run_forked(void) {                               \
+    greatestpp_pool *pool = &greatestpp_workers;                        \
+    size_t count = pool->jobs.size();                                   \
+    size_t next = 0;                                                    \
+    size_t running = 0;                                                 \
+    size_t i;                                                           \
+    std::vector<greatestpp_fork_worker> workers(                        \
+        count < greatestpp_info.forks ? count : greatestpp_info.forks); \
+    std::vector<struct pollfd> fds(workers.size());                     \
+    greatestpp_time now;                                                \
+    int wait_ms;                                                        \
+    signal(SIGPIPE, SIG_IGN);                                           \
+    pool->first_fail = SIZE_MAX;                                        \
+    for (i = 0; i < workers.size(); i++) workers[i].pid = 0;            \
+    for (;;) {                                                          \
+        for (i = 0; i < workers.size(); i++) {                          \
+            greatestpp_fork_worker *w = &workers[i];                    \
+            uint64_t index = next;                                      \
+            if (next >= count || next > pool->first_fail) break;        \
+            if (w->pid > 0 && w->job != SIZE_MAX) continue;             \
+            if (w->pid > 0 && greatestpp_info.fork_batch > 0            \
+                && w->jobs_run >= greatestpp_info.fork_batch) {         \
+                greatestpp_fork_reap(w, NULL);  /* idle: it just exits */ \
+            }                                                           \
+            if (w->pid == 0) greatestpp_fork_spawn(workers, i);         \
+            if (!greatestpp_fd_write(w->cmd_fd, &index, sizeof(index))) { \
+                greatestpp_fork_reap(w, NULL);                                \
+                continue;                                               \
+            }                                                           \
+            w->job = next++;                                            \
+            w->jobs_run++;                                              \
+            GREATESTPP_SET_TIME(w->started);                            \
+            w->deadline_ns = pool->jobs[w->job].timeout_ms == 0 ? 0     \
+                : w->started.wall_ns                                    \
+                    + pool->jobs[w->job].timeout_ms * 1000000ULL;       \
+            running++;                                                  \
+        }                                                               \
+        if (running == 0) break;                                        \
+        GREATESTPP_SET_TIME(now);                                       \
+        wait_ms = -1;                                                   \
+        for (i = 0; i < workers.size(); i++) {                          \
+            greatestpp_fork_worker *w = &workers[i];                    \
+            fds[i].fd = w->job != SIZE_MAX ? w->res_fd : -1;            \
+            fds[i].events = POLLIN;                                     \
+            fds[i].revents = 0;                                         \
+            if (w->job != SIZE_MAX && w->deadline_ns != 0) {            \
+                /* Wake up for the nearest deadline, rounding up. */    \
+                uint64_t left = w->deadline_ns > now.wall_ns            \
+                    ? (w->deadline_ns - now.wall_ns + 999999) / 1000000 : 0; \
+                if (wait_ms < 0 || left < (uint64_t)wait_ms) {          \
+                    wait_ms = (int)(left < INT_MAX ? left : INT_MAX);   \
+                }                                                       \
+            }                                                           \
+        }                                                               \
+        if (poll(&fds[0], fds.size(), wait_ms) < 0) {                   \
+            if (errno == EINTR) continue;                               \
+            perror("poll");                                             \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+        for (i = 0; i < workers.size(); i++) {                          \
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;         \
+            if (!greatestpp_fork_receive(&workers[i])) {                \
+                greatestpp_fork_reap(&workers[i], NULL);                \
+            }                                                           \
+            running--;                                                  \
+        }                                                               \
+        GREATESTPP_SET_TIME(now);                                       \
+        for (i = 0; i < workers.size(); i++) {                          \
+            greatestpp_fork_worker *w = &workers[i];                    \
+            char reason[64];                                            \
+            if (w->job == SIZE_MAX || w->deadline_ns == 0               \
+                || now.wall_ns < w->deadline_ns) {                      \
+                continue;                                               \
+            }                                                           \
+            snprintf(reason, sizeof(reason), "TIMEOUT after %u ms",     \
+                pool->jobs[w->job].timeout_ms);                         \
+            kill(w->pid, SIGKILL);                                      \
+            greatestpp_fork_reap(w, reason);                            \
+            running--;                                                  \
+        }                                                               \
+    }                                                                   \
+    for (i = 0; i < workers.size(); i++) {                              \
+        if (workers[i].pid > 0) greatestpp_fork_reap(&workers[i], NULL);      \
+    }                                                                   \
+}
+#else
+#define GREATESTPP_FORK_DEFS()                                          \
+static void greatestpp_run_forked(void) {                               \
+    greatestpp_run_threaded();                                          \
+}
+#endif
+
+#if defined(GREATESTPP_TRACK_ALLOCS)
+/* Count a block of USABLE bytes, SIZE of them requested. A block freed
+ * during a test but allocated before it offsets a leak. */
+#define GREATESTPP_ALLOC_COUNTERS()                                     \
+thread_local greatestpp_alloc_counter greatestpp_alloc_tls;             \
+                                                                        \
+static void greatestpp_note_alloc(size_t size, size_t usable) {         \
+    greatestpp_alloc_counter *c = &greatestpp_alloc_tls;                \
+    if (!c->active) return;                                             \
+    c->stats.allocs++;                                                  \
+    c->stats.bytes += size;                                             \
+    c->stats.live += (int64_t)usable;                                   \
+    if (c->stats.live > c->stats.peak) c->stats.peak = c->stats.live;   \
+}                                                                       \
+                                                                        \
+static void greatestpp_note_free(size_t usable) {                       \
+    greatestpp_alloc_counter *c = &greatestpp_alloc_tls;                \
+    if (!c->active) return;                                             \
+    c->stats.frees++;                                                   \
+    c->stats.live -= (int64_t)usable;                                   \
+}
+#endif
+
+#if defined(GREATESTPP_TRACK_ALLOCS) && defined(__GLIBC__)
+/* Replace glibc's malloc family; operator new allocates through it. */
+#define GREATESTPP_ALLOC_DEFS()                                         \
+GREATESTPP_ALLOC_COUNTERS()                                             \
+                                                                        \
+static void *greatestpp_counted(void *p, size_t size) {                 \
+    if (p) greatestpp_note_alloc(size, malloc_usable_size(p));          \
+    return p;                                                           \
+}                                                                       \
+                                                                        \
+extern "C" void *malloc(size_t size) noexcept {                         \
+    return greatestpp_counted(__libc_malloc(size), size);               \
+}                                                                       \
+                                                                        \
+extern "C" void *calloc(size_t count, size_t size) noexcept {           \
+    return greatestpp_counted(__libc_calloc(count, size), count * size); \
+}                                                                       \
+                                                                        \
+extern "C" void *realloc(void *p, size_t size) noexcept {               \
+    size_t old = p ? malloc_usable_size(p) : 0;                         \
+    void *q = __libc_realloc(p, size);                                  \
+    if (q == NULL && size > 0) return NULL;     /* p is untouched */    \
+    if (p) greatestpp_note_free(old);                                   \
+    return greatestpp_counted(q, size);                                 \
+}                                                                       \
+                                                                        \
+extern "C" void free(void *p) noexcept {                                \
+    if (p == NULL) return;                                              \
+    greatestpp_note_free(malloc_usable_size(p));                        \
+    __libc_free(p);                                                     \
+}                                                                       \
+                                                                        \
+extern "C" void *memalign(size_t align, size_t size) noexcept {         \
+    return greatestpp_counted(__libc_memalign(align, size), size);      \
+}                                                                       \
+                                                                        \
+extern "C" void *aligned_alloc(size_t align, size_t size) noexcept {    \
+    return greatestpp_counted(__libc_memalign(align, size), size);      \
+}                                                                       \
+                                                                        \
+extern "C" int posix_memalign(void **p, size_t align,                   \
+                              size_t size) noexcept {                   \
+    void *q;                                                            \
+    if (align < sizeof(void *) || (align & (align - 1)) != 0) {         \
+        return EINVAL;                                                  \
+    }                                                                   \
+    q = greatestpp_counted(__libc_memalign(align, size), size);         \
+    if (q == NULL) return ENOMEM;                                       \
+    *p = q;                                                             \
+    return 0;                                                           \
+}
+#elif defined(GREATESTPP_TRACK_ALLOCS)
+/* Replace the global operator new and delete, keeping each block's
+ * size in a header in front of it. */
+#define GREATESTPP_ALLOC_HEADER alignof(std::max_align_t)
+#define GREATESTPP_ALLOC_DEFS()                                         \
+GREATESTPP_ALLOC_COUNTERS()                                             \
+                                                                        \
+static void *greatestpp_new(size_t size) {                              \
+    char *p = (char *)malloc(size + GREATESTPP_ALLOC_HEADER);           \
+    if (p == NULL) return NULL;                                         \
+    memcpy(p, &size, sizeof(size));                                     \
+    greatestpp_note_alloc(size, size);                                  \
+    return p + GREATESTPP_ALLOC_HEADER;                                 \
+}                                                                       \
+                                                                        \
+static void greatestpp_delete(void *p) {                                \
+    char *block = (char *)p - GREATESTPP_ALLOC_HEADER;                  \
+    size_t size;                                                        \
+    if (p == NULL) return;                                              \
+    memcpy(&size, block, sizeof(size));                                 \
+    greatestpp_note_free(size);                                         \
+    free(block);                                                        \
+}                                                                       \
+                                                                        \
+void *operator new(size_t size) {                                       \
+    void *p = greatestpp_new(size);                                     \
+    if (p == NULL) throw std::bad_alloc();                              \
+    return p;                                                           \
+}                                                                       \
+                                                                        \
+void *operator new[](size_t size) {                                     \
+    void *p = greatestpp_new(size);                                     \
+    if (p == NULL) throw std::bad_alloc();                              \
+    return p;                                                           \
+}                                                                       \
+                                                                        \
+void *operator new(size_t size, const std::nothrow_t &) noexcept {      \
+    return greatestpp_new(size);                                        \
+}                                                                       \
+                                                                        \
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {    \
+    return greatestpp_new(size);                                        \
+}                                                                       \
+                                                                        \
+void operator delete(void *p) noexcept { greatestpp_delete(p); }        \
+void operator delete[](void *p) noexcept { greatestpp_delete(p); }      \
+void operator delete(void *p, size_t) noexcept { greatestpp_delete(p); } \
+void operator delete[](void *p, size_t) noexcept { greatestpp_delete(p); } \
+void operator delete(void *p, const std::nothrow_t &) noexcept {        \
+    greatestpp_delete(p);                                               \
+}                                                                       \
+void operator delete[](void *p, const std::nothrow_t &) noexcept {      \
+    greatestpp_delete(p);                                               \
+}
+#else
+#define GREATESTPP_ALLOC_DEFS()
+#endif
+
+#if GREATESTPP_HAVE_PERF
+/* Per-thread hardware counters for --perf. Counting is limited to user
+ * space, so it works with the default perf_event_paranoid setting. */
+#define GREATESTPP_PERF_DEFS()                                          \
+static thread_local greatestpp_perf_group greatestpp_perf_tls;          \
+                                                                        \
+static void greatestpp_perf_close(greatestpp_perf_group *g) {           \
+    int i;                                                              \
+    for (i = 0; i < GREATESTPP_PERF_EVENTS; i++) {                      \
+        if (g->fd[i] >= 0) close(g->fd[i]);                             \
+        g->fd[i] = -1;                                                  \
+    }                                                                   \
+    g->opened = 0;                                                      \
+}                                                                       \
+                                                                        \
+greatestpp_perf_group::~greatestpp_perf_group() {                       \
+    greatestpp_perf_close(this);                                        \
+}                                                                       \
+                                                                        \
+/* Open this thread's counters, once. Returns 0 if the cycle counter    \
+ * is unavailable, with errno set. */                                   \
+static int greatestpp_perf_open(greatestpp_perf_group *g) {             \
+    static const uint64_t events[GREATESTPP_PERF_EVENTS] = {            \
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,           \
+        PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,        \
+    };                                                                  \
+    struct perf_event_attr attr;                                        \
+    int i;                                                              \
+    if (g->opened) return g->fd[0] >= 0;                                \
+    g->opened = 1;                                                      \
+    for (i = 0; i < GREATESTPP_PERF_EVENTS; i++) {                      \
+        memset(&attr, 0, sizeof(attr));                                 \
+        attr.type = PERF_TYPE_HARDWARE;                                 \
+        attr.size = sizeof(attr);                                       \
+        attr.config = events[i];                                        \
+        attr.disabled = i == 0;                                         \
+        attr.exclude_kernel = 1;                                        \
+        attr.exclude_hv = 1;                                            \
+        attr.read_format = PERF_FORMAT_GROUP;                           \
+        g->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,      \
+            i == 0 ? -1 : g->fd[0], 0);                                 \
+        if (g->fd[0] < 0) return 0;                                     \
+    }                                                                   \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+/* Check that counters can be read, or carry on without them. */        \
+void greatestpp_perf_init(void) {                                       \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_PERF)) return;        \
+    if (greatestpp_perf_open(&greatestpp_perf_tls)) return;             \
+    fprintf(greatestpp_notes(),                                         \
+        "--perf: hardware counters unavailable (%s)%s; "                \
+        "continuing without them\n", strerror(errno),                   \
+        errno == EACCES || errno == EPERM                               \
+            ? ", see kernel.perf_event_paranoid" : "");                 \
+    greatestpp_info.flags &= ~GREATESTPP_FLAG_PERF;                     \
+}                                                                       \
+                                                                        \
+/* A forked worker can't use counters opened by its parent's thread. */ \
+static void greatestpp_perf_reset(void) {                               \
+    greatestpp_perf_close(&greatestpp_perf_tls);                        \
+}                                                                       \
+                                                                        \
+static void greatestpp_perf_start(void) {                               \
+    greatestpp_perf_group *g = &greatestpp_perf_tls;                    \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_PERF)) return;        \
+    if (!greatestpp_perf_open(g)) return;                               \
+    ioctl(g->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);         \
+    ioctl(g->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);        \
+}                                                                       \
+                                                                        \
+/* Stop the counters and add their counts to P. */                      \
+static void greatestpp_perf_stop(greatestpp_perf *p) {                  \
+    greatestpp_perf_group *g = &greatestpp_perf_tls;                    \
+    uint64_t buf[1 + GREATESTPP_PERF_EVENTS];                           \
+    uint64_t *counts[GREATESTPP_PERF_EVENTS];                           \
+    uint64_t i, n = 0;                                                  \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_PERF)) return;        \
+    if (g->fd[0] < 0) return;                                           \
+    ioctl(g->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);       \
+    if (read(g->fd[0], buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) { \
+        return;                                                         \
+    }                                                                   \
+    counts[0] = &p->cycles;                                             \
+    counts[1] = &p->instructions;                                       \
+    counts[2] = &p->branch_misses;                                      \
+    counts[3] = &p->cache_misses;                                       \
+    /* The group's values come in the order its events were opened. */  \
+    for (i = 0; i < GREATESTPP_PERF_EVENTS && n < buf[0]; i++) {        \
+        if (g->fd[i] >= 0) *counts[i] += buf[1 + n++];                  \
+    }                                                                   \
+}
+#else
+#define GREATESTPP_PERF_DEFS()                                          \
+void greatestpp_perf_init(void) {                                       \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_PERF)) return;        \
+    fprintf(greatestpp_notes(), "--perf: hardware counters are not "    \
+        "supported on this platform; continuing without them\n");       \
+    greatestpp_info.flags &= ~GREATESTPP_FLAG_PERF;                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_perf_reset(void) {}                              \
+static void greatestpp_perf_start(void) {}                              \
+static void greatestpp_perf_stop(greatestpp_perf *p) { (void)p; }
+#endif
+
+#if GREATESTPP_HAVE_PROFILE
+#if defined(__linux__)
+/* Read the function symbols of the test runner itself, from its ELF
+ * symbol table, so static functions (like tests) can be named too. */
+#define GREATESTPP_PROFILE_SYMBOL_DEFS()                                \
+static void greatestpp_profile_load_symbols(void) {                     \
+    greatestpp_profiler *p = &greatestpp_prof;                          \
+    const ElfW(Ehdr) *eh;                                               \
+    const ElfW(Shdr) *sh;                                               \
+    struct stat st;                                                     \
+    Dl_info dl;                                                         \
+    void *map;                                                          \
+    int fd, i;                                                          \
+    fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);                  \
+    if (fd < 0) return;                                                 \
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*eh)) {      \
+        close(fd);                                                      \
+        return;                                                         \
+    }                                                                   \
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); \
+    close(fd);                                                          \
+    if (map == MAP_FAILED) return;                                      \
+    eh = (const ElfW(Ehdr) *)map;                                       \
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0                       \
+        || eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(*sh)            \
+            > (uint64_t)st.st_size) {                                   \
+        munmap(map, (size_t)st.st_size);                                \
+        return;                                                         \
+    }                                                                   \
+    sh = (const ElfW(Shdr) *)((const char *)map + eh->e_shoff);         \
+    for (i = 0; i < eh->e_shnum; i++) {                                 \
+        const ElfW(Shdr) *strs = &sh[sh[i].sh_link];                    \
+        const ElfW(Sym) *syms;                                          \
+        size_t n, k, base;                                              \
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum) { \
+            continue;                                                   \
+        }                                                               \
+        if (sh[i].sh_offset + sh[i].sh_size > (uint64_t)st.st_size      \
+            || strs->sh_offset + strs->sh_size > (uint64_t)st.st_size) { \
+            continue;                                                   \
+        }                                                               \
+        /* Copy the names, as the file is unmapped afterward. */        \
+        base = p->strtab.size();                                        \
+        p->strtab.insert(p->strtab.end(),                               \
+            (const char *)map + strs->sh_offset,                        \
+            (const char *)map + strs->sh_offset + strs->sh_size);       \
+        p->strtab.push_back('\0');                                      \
+        syms = (const ElfW(Sym) *)((const char *)map + sh[i].sh_offset); \
+        n = sh[i].sh_size / sizeof(*syms);                              \
+        for (k = 0; k < n; k++) {                                       \
+            greatestpp_profile_symbol sym;                              \
+            if (ELF64_ST_TYPE(syms[k].st_info) != STT_FUNC              \
+                || syms[k].st_value == 0 || syms[k].st_name >= strs->sh_size) { \
+                continue;                                               \
+            }                                                           \
+            sym.addr = (uintptr_t)syms[k].st_value;                     \
+            sym.size = (uintptr_t)syms[k].st_size;                      \
+            sym.name = (const char *)(uintptr_t)(base + syms[k].st_name); \
+            p->symbols.push_back(sym);                                  \
+        }                                                               \
+    }                                                                   \
+    /* Names were stored as offsets while strtab could still move. */   \
+    for (i = 0; i < (int)p->symbols.size(); i++) {                      \
+        p->symbols[i].name = &p->strtab[(uintptr_t)p->symbols[i].name]; \
+    }                                                                   \
+    std::sort(p->symbols.begin(), p->symbols.end());                    \
+    /* Position-independent executables' symbols are load-relative. */  \
+    if (eh->e_type == ET_DYN                                            \
+        && dladdr((void *)&greatestpp_profile_load_symbols, &dl)) {     \
+        p->exe_base = dl.dli_fbase;                                     \
+    }                                                                   \
+    munmap(map, (size_t)st.st_size);                                    \
+}                                                                       \
+                                                                        \
+/* Find the function at PC in the runner's own symbols, or NULL. */     \
+static const char *greatestpp_profile_exe_symbol(void *pc) {            \
+    const std::vector<greatestpp_profile_symbol> &syms =                \
+        greatestpp_prof.symbols;                                        \
+    greatestpp_profile_symbol key;                                      \
+    std::vector<greatestpp_profile_symbol>::const_iterator it;          \
+    key.addr = (uintptr_t)pc - (uintptr_t)greatestpp_prof.exe_base;     \
+    key.size = 0;                                                       \
+    key.name = NULL;                                                    \
+    it = std::upper_bound(syms.begin(), syms.end(), key);               \
+    if (it == syms.begin()) return NULL;                                \
+    --it;                                                               \
+    if (it->size > 0 && key.addr >= it->addr + it->size) return NULL;   \
+    return it->name;                                                    \
+}
+#else
+#define GREATESTPP_PROFILE_SYMBOL_DEFS()                                \
+static void greatestpp_profile_load_symbols(void) {}                    \
+static const char *greatestpp_profile_exe_symbol(void *pc) {            \
+    (void)pc;                                                           \
+    return NULL;                                                        \
+}
+#endif
+
+/* Definitions for --profile. ITIMER_PROF counts the whole process's
+ * CPU time, so this only works with tests run one at a time, and time
+ * spent blocked doesn't show up. */
+#define GREATESTPP_PROFILE_DEFS()                                       \
+static greatestpp_profiler greatestpp_prof;                             \
+                                                                        \
+GREATESTPP_PROFILE_SYMBOL_DEFS()                                        \
+                                                                        \
+static void greatestpp_profile_signal(int sig) {                        \
+    int saved = errno;                                                  \
+    int n = greatestpp_prof.count;                                      \
+    (void)sig;                                                          \
+    if (!greatestpp_prof.active) return;                                \
+    if (n < GREATESTPP_PROFILE_SAMPLES) {                               \
+        greatestpp_profile_sample *s = &greatestpp_prof.samples[n];     \
+        s->depth = backtrace(s->pc, GREATESTPP_PROFILE_DEPTH);          \
+        greatestpp_prof.count = n + 1;                                  \
+    } else {                                                            \
+        greatestpp_prof.dropped = greatestpp_prof.dropped + 1;          \
+    }                                                                   \
+    errno = saved;                                                      \
+}                                                                       \
+                                                                        \
+void greatestpp_profile_init(void) {                                    \
+    const char *dir = greatestpp_info.profile_dir;                      \
+    struct sigaction sa;                                                \
+    void *pc[1];                                                        \
+    if (dir == NULL || GREATESTPP_LIST_ONLY()) return;                  \
+    if (greatestpp_info.jobs > 1 || greatestpp_info.forks > 0) {        \
+        fprintf(greatestpp_notes(),                                     \
+            "--profile can't be used with -j or -p\n");                 \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {                     \
+        fprintf(greatestpp_notes(), "Could not create %s: %s\n",        \
+            dir, strerror(errno));                                      \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    greatestpp_prof.samples = (greatestpp_profile_sample *)calloc(      \
+        GREATESTPP_PROFILE_SAMPLES, sizeof(greatestpp_profile_sample)); \
+    if (greatestpp_prof.samples == NULL) {                              \
+        fprintf(greatestpp_notes(), "Out of memory\n");                 \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    /* The first backtrace() may load libgcc, which isn't safe to do    \
+     * in a signal handler. */                                          \
+    backtrace(pc, 1);                                                   \
+    greatestpp_profile_load_symbols();                                  \
+    memset(&sa, 0, sizeof(sa));                                         \
+    sa.sa_handler = greatestpp_profile_signal;                          \
+    sa.sa_flags = SA_RESTART;                                           \
+    sigemptyset(&sa.sa_mask);                                           \
+    sigaction(SIGPROF, &sa, NULL);                                      \
+}                                                                       \
+                                                                        \
+static void greatestpp_profile_timer(long usec) {                       \
+    struct itimerval it;                                                \
+    memset(&it, 0, sizeof(it));                                         \
+    it.it_interval.tv_usec = usec;                                      \
+    it.it_value.tv_usec = usec;                                         \
+    setitimer(ITIMER_PROF, &it, NULL);                                  \
+}                                                                       \
+                                                                        \
+static void greatestpp_profile_start(void) {                            \
+    if (greatestpp_prof.samples == NULL) return;                        \
+    greatestpp_prof.count = 0;                                          \
+    greatestpp_prof.dropped = 0;                                        \
+    greatestpp_prof.active = 1;                                         \
+    greatestpp_profile_timer(1000000 / GREATESTPP_PROFILE_HZ);          \
+}                                                                       \
+                                                                        \
+static void greatestpp_profile_stop(void) {                             \
+    if (greatestpp_prof.samples == NULL) return;                        \
+    greatestpp_profile_timer(0);                                        \
+    greatestpp_prof.active = 0;                                         \
+}                                                                       \
+                                                                        \
+/* Name the function PC is in, for a folded stack, demangled if it's    \
+ * a C++ symbol, else as its object file and offset. */                 \
+static const std::string &greatestpp_profile_frame(void *pc) {          \
+    std::string &name = greatestpp_prof.frames[pc];                     \
+    const char *sym = NULL;                                             \
+    Dl_info dl;                                                         \
+    char buf[64];                                                       \
+    if (!name.empty()) return name;                                     \
+    memset(&dl, 0, sizeof(dl));                                         \
+    if (dladdr(pc, &dl) && dl.dli_sname) {                              \
+        sym = dl.dli_sname;                                             \
+    } else if (dl.dli_fbase == greatestpp_prof.exe_base                 \
+        || greatestpp_prof.exe_base == NULL) {                          \
+        sym = greatestpp_profile_exe_symbol(pc);                        \
+    }                                                                   \
+    if (sym) {                                                          \
+        int status = 0;                                                 \
+        char *demangled = abi::__cxa_demangle(sym, NULL, NULL, &status); \
+        name = status == 0 && demangled ? demangled : sym;              \
+        free(demangled);                                                \
+    } else if (dl.dli_fname) {                                          \
+        const char *base = strrchr(dl.dli_fname, '/');                  \
+        snprintf(buf, sizeof(buf), "+0x%llx", (unsigned long long)      \
+            ((char *)pc - (char *)dl.dli_fbase));                       \
+        name = std::string(base ? base + 1 : dl.dli_fname) + buf;       \
+    } else {                                                            \
+        snprintf(buf, sizeof(buf), "%p", pc);                           \
+        name = buf;                                                     \
+    }                                                                   \
+    /* ';' separates frames, so it can't appear in one. */              \
+    std::replace(name.begin(), name.end(), ';', ':');                   \
+    return name;                                                        \
+}                                                                       \
+                                                                        \
+/* Write the samples of the test NAME, if it took long enough, to       \
+ * DIR/SUITE.NAME.folded: one line per distinct stack, outermost frame  \
+ * first, then how many samples had it, ready for flamegraph.pl. */     \
+static void greatestpp_profile_write(const char *name,                  \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    std::unordered_map<std::string, unsigned int> stacks;               \
+    std::vector<std::pair<std::string, unsigned int> > sorted;          \
+    std::string path, stack;                                            \
+    const char *p;                                                      \
+    FILE *f;                                                            \
+    int i, d;                                                           \
+    if (greatestpp_prof.samples == NULL) return;                        \
+    if (greatestpp_prof.count == 0 && greatestpp_prof.dropped == 0) return; \
+    if (post.wall_ns - pre.wall_ns                                      \
+        < (uint64_t)greatestpp_info.profile_threshold_ms * 1000000) {   \
+        return;                                                         \
+    }                                                                   \
+    for (i = 0; i < greatestpp_prof.count; i++) {                       \
+        const greatestpp_profile_sample *s = &greatestpp_prof.samples[i]; \
+        stack.clear();                                                  \
+        /* Skip the signal handler and the kernel's signal frame. */    \
+        for (d = s->depth - 1; d >= 2; d--) {                           \
+            if (!stack.empty()) stack += ';';                           \
+            stack += greatestpp_profile_frame(s->pc[d]);                \
+        }                                                               \
+        if (!stack.empty()) stacks[stack]++;                            \
+    }                                                                   \
+    if (greatestpp_prof.dropped > 0) {                                  \
+        stacks["[dropped]"] += greatestpp_prof.dropped;                 \
+    }                                                                   \
+    sorted.assign(stacks.begin(), stacks.end());                        \
+    std::sort(sorted.begin(), sorted.end());                            \
+    path = std::string(greatestpp_info.profile_dir) + "/";              \
+    for (p = greatestpp_info.suite.name; *p; p++) path += *p;           \
+    path += '.';                                                        \
+    path += name;                                                       \
+    for (i = (int)strlen(greatestpp_info.profile_dir) + 1;              \
+         i < (int)path.size(); i++) {                                   \
+        char c = path[i];                                               \
+        if (!isalnum((unsigned char)c) && c != '.' && c != '-') path[i] = '_'; \
+    }                                                                   \
+    path += ".folded";                                                  \
+    f = fopen(path.c_str(), "w");                                       \
+    if (f == NULL) {                                                    \
+        fprintf(greatestpp_notes(), "Could not open %s\n", path.c_str()); \
+        return;                                                         \
+    }                                                                   \
+    for (i = 0; i < (int)sorted.size(); i++) {                          \
+        fprintf(f, "%s %u\n", sorted[i].first.c_str(), sorted[i].second); \
+    }                                                                   \
+    fclose(f);                                                          \
+}
+#else
+#define GREATESTPP_PROFILE_DEFS()                                       \
+void greatestpp_profile_init(void) {                                    \
+    if (greatestpp_info.profile_dir == NULL) return;                    \
+    fprintf(greatestpp_notes(), "--profile: not supported on this "     \
+        "platform; continuing without it\n");                           \
+    greatestpp_info.profile_dir = NULL;                                 \
+}                                                                       \
+                                                                        \
+static void greatestpp_profile_start(void) {}                           \
+static void greatestpp_profile_stop(void) {}                            \
+static void greatestpp_profile_write(const char *name,                  \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    (void)name; (void)pre; (void)post;                                  \
+}
+#endif
+
+#if GREATESTPP_HAVE_RSS
+/* Definitions for measuring tests' RSS. The peak comes from VmHWM,
+ * which writing 5 to /proc/self/clear_refs resets. RSS is the whole
+ * process's, so with -j it includes the tests running alongside. */
+#define GREATESTPP_MEMORY_DEFS()                                        \
+/* Set by the first ASSERT_RSS_UNDER, to measure later tests too. */    \
+static std::atomic<bool> greatestpp_rss_budgets(false);                 \
+                                                                        \
+void greatestpp_memory_init(void) {}                                    \
+                                                                        \
+/* Read the current and peak RSS, in kB. Returns 0 on error. */         \
+static int greatestpp_read_rss(uint64_t *rss_kb, uint64_t *peak_kb) {   \
+    char buf[4096];                                                     \
+    const char *p;                                                      \
+    ssize_t n;                                                          \
+    int fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);           \
+    if (fd < 0) return 0;                                               \
+    n = read(fd, buf, sizeof(buf) - 1);                                 \
+    close(fd);                                                          \
+    if (n <= 0) return 0;                                               \
+    buf[n] = '\0';                                                      \
+    p = strstr(buf, "VmHWM:");                                          \
+    if (p == NULL) return 0;                                            \
+    *peak_kb = strtoull(p + 6, NULL, 10);                               \
+    p = strstr(buf, "VmRSS:");                                          \
+    if (p == NULL) return 0;                                            \
+    *rss_kb = strtoull(p + 6, NULL, 10);                                \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+static void greatestpp_memory_start(void) {                             \
+    greatestpp_memory *m = &greatestpp_test.mem;                        \
+    struct rusage ru;                                                   \
+    uint64_t peak;                                                      \
+    int fd;                                                             \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_MEMORY)               \
+        && !greatestpp_rss_budgets.load(std::memory_order_relaxed)) {   \
+        return;                                                         \
+    }                                                                   \
+    fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);           \
+    if (fd >= 0) {                                                      \
+        if (write(fd, "5", 1) != 1) {}                                  \
+        close(fd);                                                      \
+    }                                                                   \
+    if (!greatestpp_read_rss(&m->start_kb, &peak)) return;              \
+    getrusage(RUSAGE_THREAD, &ru);                                      \
+    m->minor_faults = (uint64_t)ru.ru_minflt;                           \
+    m->major_faults = (uint64_t)ru.ru_majflt;                           \
+    m->sampled = 1;                                                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_memory_stop(greatestpp_memory *m) {              \
+    struct rusage ru;                                                   \
+    if (!m->sampled) return;                                            \
+    getrusage(RUSAGE_THREAD, &ru);                                      \
+    m->minor_faults = (uint64_t)ru.ru_minflt - m->minor_faults;         \
+    m->major_faults = (uint64_t)ru.ru_majflt - m->major_faults;         \
+    if (!greatestpp_read_rss(&m->end_kb, &m->peak_kb)) m->sampled = 0;  \
+}                                                                       \
+                                                                        \
+int greatestpp_check_rss(const char *msg, const char *file,             \
+                         unsigned int line, uint64_t limit_kb) {        \
+    uint64_t rss, peak;                                                 \
+    char buf[128];                                                      \
+    greatestpp_rss_budgets.store(true, std::memory_order_relaxed);      \
+    if (!greatestpp_read_rss(&rss, &peak)) return 0;                    \
+    /* VmHWM is only reset for sampled tests, so before the first       \
+     * budget, the current RSS is all there is for this test. */        \
+    if (!greatestpp_test.mem.sampled) peak = rss;                       \
+    if (peak < limit_kb) return 0;                                      \
+    snprintf(buf, sizeof(buf), ": %llu kB, over %llu kB%s",             \
+        (unsigned long long)peak, (unsigned long long)limit_kb,         \
+        greatestpp_test.mem.sampled ? "" : " (current, not peak)");     \
+    greatestpp_fail_msg = msg ? msg : "";                               \
+    greatestpp_fail_msg += buf;                                         \
+    greatestpp_fail_at(greatestpp_fail_msg.c_str(), file, line);        \
+    return -1;                                                          \
+}
+#else
+#define GREATESTPP_MEMORY_DEFS()                                        \
+void greatestpp_memory_init(void) {                                     \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_MEMORY)) return;      \
+    fprintf(greatestpp_notes(), "--memory-report: not supported on this " \
+        "platform; continuing without it\n");                           \
+    greatestpp_info.flags &= ~GREATESTPP_FLAG_MEMORY;                   \
+    greatestpp_info.memory_report = 0;                                  \
+}                                                                       \
+                                                                        \
+static void greatestpp_memory_start(void) {}                            \
+static void greatestpp_memory_stop(greatestpp_memory *m) { (void)m; }   \
+                                                                        \
+int greatestpp_check_rss(const char *msg, const char *file,             \
+                         unsigned int line, uint64_t limit_kb) {        \
+    (void)msg; (void)file; (void)line; (void)limit_kb;                  \
+    return 0;                                                           \
+}
+#endif
+
+#if GREATESTPP_HAVE_MMAP
+/* Map a corpus file read-only. Returns 0 on error. */
+#define GREATESTPP_CORPUS_DEFS()                                        \
+static int greatestpp_map_file(greatestpp_corpus *c, const char *path,  \
+                               greatestpp_slice *out) {                 \
+    struct stat st;                                                     \
+    void *p;                                                            \
+    int fd = open(path, O_RDONLY);                                      \
+    if (fd < 0) return 0;                                               \
+    if (fstat(fd, &st) != 0) {                                          \
+        close(fd);                                                      \
+        return 0;                                                       \
+    }                                                                   \
+    out->data = "";                                                     \
+    out->size = 0;                                                      \
+    if (st.st_size > 0) {                                               \
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); \
+        if (p == MAP_FAILED) {                                          \
+            close(fd);                                                  \
+            return 0;                                                   \
+        }                                                               \
+        out->data = (const char *)p;                                    \
+        out->size = (size_t)st.st_size;                                 \
+        c->maps.push_back(*out);                                        \
+    }                                                                   \
+    close(fd);                                                          \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+greatestpp_corpus::~greatestpp_corpus() {                               \
+    size_t i;                                                           \
+    for (i = 0; i < maps.size(); i++) {                                 \
+        munmap((void *)maps[i].data, maps[i].size);                     \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* If PATH is a directory, list its files, sorted, skipping dotfiles    \
+ * and subdirectories. Returns 0 if it isn't a directory. */            \
+static int greatestpp_corpus_files(const char *path,                    \
+                                   std::vector<std::string> *files) {   \
+    struct stat st;                                                     \
+    struct dirent *e;                                                   \
+    DIR *dir;                                                           \
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return 0;         \
+    dir = opendir(path);                                                \
+    if (dir == NULL) return 0;                                          \
+    while ((e = readdir(dir)) != NULL) {                                \
+        std::string file = std::string(path) + "/" + e->d_name;         \
+        if (e->d_name[0] == '.') continue;                              \
+        if (stat(file.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue; \
+        files->push_back(e->d_name);                                    \
+    }                                                                   \
+    closedir(dir);                                                      \
+    std::sort(files->begin(), files->end());                            \
+    return 1;                                                           \
+}
+#else
+/* Read a corpus file into memory. Returns 0 on error. */
+#define GREATESTPP_CORPUS_DEFS()                                        \
+static int greatestpp_map_file(greatestpp_corpus *c, const char *path,  \
+                               greatestpp_slice *out) {                 \
+    FILE *f = fopen(path, "rb");                                        \
+    char buf[65536];                                                    \
+    size_t n;                                                           \
+    if (f == NULL) return 0;                                            \
+    c->buffers.push_back(std::string());                                \
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {                   \
+        c->buffers.back().append(buf, n);                               \
+    }                                                                   \
+    fclose(f);                                                          \
+    out->data = c->buffers.back().data();                               \
+    out->size = c->buffers.back().size();                               \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+greatestpp_corpus::~greatestpp_corpus() {}                              \
+                                                                        \
+static int greatestpp_corpus_files(const char *path,                    \
+                                   std::vector<std::string> *files) {   \
+    (void)path;                                                         \
+    (void)files;                                                        \
+    return 0;                                                           \
+}
+#endif
+
+#if GREATESTPP_HAVE_MMAP
+/* Write the --journal through a shared mapping, so each record costs a
+ * copy, and is in the page cache even if the process dies right after.
+ * Map room for CAPACITY records after the header. Returns 0 on error. */
+#define GREATESTPP_JOURNAL_DEFS()                                       \
+static int greatestpp_journal_map(size_t capacity) {                    \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    size_t size = (capacity + 1) * sizeof(greatestpp_journal_record);   \
+    void *p;                                                            \
+    if (ftruncate(j->fd, (off_t)size) != 0) return 0;                   \
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0); \
+    if (p == MAP_FAILED) return 0;                                      \
+    if (j->map != NULL) {                                               \
+        munmap(j->map,                                                  \
+            (j->capacity + 1) * sizeof(greatestpp_journal_record));     \
+    }                                                                   \
+    j->map = (char *)p;                                                 \
+    j->capacity = capacity;                                             \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+static int greatestpp_journal_start(const char *path,                   \
+                                    const greatestpp_journal_header *h) { \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    j->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);               \
+    if (j->fd < 0) return 0;                                            \
+    if (!greatestpp_journal_map(GREATESTPP_JOURNAL_RECORDS)) {          \
+        close(j->fd);                                                   \
+        return 0;                                                       \
+    }                                                                   \
+    memcpy(j->map, h, sizeof(*h));                                      \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+/* Where to put the next record, or NULL if the journal can't grow. */  \
+static greatestpp_journal_record *greatestpp_journal_slot(void) {       \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    if (j->count == j->capacity                                         \
+        && !greatestpp_journal_map(2 * j->capacity)) {                  \
+        return NULL;                                                    \
+    }                                                                   \
+    return (greatestpp_journal_record *)j->map + j->count + 1;          \
+}                                                                       \
+                                                                        \
+static void greatestpp_journal_commit(greatestpp_journal_record *r,     \
+                                      uint32_t kind) {                  \
+    /* Only a record with its kind set counts. */                       \
+    std::atomic_signal_fence(std::memory_order_release);                \
+    r->kind = kind;                                                     \
+    greatestpp_journal_out.count++;                                     \
+}                                                                       \
+                                                                        \
+/* Unmap the journal and trim it to the records written. */             \
+static void greatestpp_journal_finish(void) {                           \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    size_t size = sizeof(greatestpp_journal_record);                    \
+    munmap(j->map, (j->capacity + 1) * size);                           \
+    j->map = NULL;                                                      \
+    if (ftruncate(j->fd, (off_t)((j->count + 1) * size)) != 0) {}       \
+    close(j->fd);                                                       \
+}
+#else
+/* Write the --journal with stdio, flushing each record. */
+#define GREATESTPP_JOURNAL_DEFS()                                       \
+static int greatestpp_journal_start(const char *path,                   \
+                                    const greatestpp_journal_header *h) { \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    j->file = fopen(path, "wb");                                        \
+    if (j->file == NULL) return 0;                                      \
+    fwrite(h, sizeof(*h), 1, j->file);                                  \
+    fflush(j->file);                                                    \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+static greatestpp_journal_record *greatestpp_journal_slot(void) {       \
+    greatestpp_journal_record *r = &greatestpp_journal_out.scratch;     \
+    memset(r, 0, sizeof(*r));                                           \
+    return r;                                                           \
+}                                                                       \
+                                                                        \
+static void greatestpp_journal_commit(greatestpp_journal_record *r,     \
+                                      uint32_t kind) {                  \
+    greatestpp_journal *j = &greatestpp_journal_out;                    \
+    r->kind = kind;                                                     \
+    fwrite(r, sizeof(*r), 1, j->file);                                  \
+    fflush(j->file);                                                    \
+    j->count++;                                                         \
+}                                                                       \
+                                                                        \
+static void greatestpp_journal_finish(void) {                           \
+    fclose(greatestpp_journal_out.file);                                \
+    greatestpp_journal_out.file = NULL;                                 \
+}
+#endif
+
+#if GREATESTPP_HAVE_ASYNC
+/* Definitions for running async tests: an epoll loop on the main
+ * thread resumes each test when what it waits on is ready, with its
+ * own greatestpp_test swapped in, so assertions are charged to it. */
+#define GREATESTPP_ASYNC_DEFS()                                         \
+void greatestpp_queue_async(const char *name,                           \
+                            std::function<greatestpp_task(void)> start) { \
+    greatestpp_async_test t;                                            \
+    if (!greatestpp_want_test(name)) return;                            \
+    if (GREATESTPP_LIST_ONLY()) {                                       \
+        fprintf(GREATESTPP_STDOUT, "  %s\n", name);                     \
+        return;                                                         \
+    }                                                                   \
+    t.name = name;                                                      \
+    t.start = start;                                                    \
+    t.setup = greatestpp_info.setup;                                    \
+    t.setup_udata = greatestpp_info.setup_udata;                        \
+    t.teardown = greatestpp_info.teardown;                              \
+    t.teardown_udata = greatestpp_info.teardown_udata;                  \
+    t.timeout_ms = greatestpp_timeout();                                \
+    t.state = GREATESTPP_ASYNC_QUEUED;                                  \
+    t.fd = -1;                                                          \
+    t.wait_error = 0;                                                   \
+    t.wake_ns = 0;                                                      \
+    t.deadline_ns = 0;                                                  \
+    t.res = 0;                                                          \
+    t.cpu_ns = 0;                                                       \
+    memset(&t.info, 0, sizeof(t.info));                                 \
+    greatestpp_async.tests.push_back(std::move(t));                     \
+}                                                                       \
+                                                                        \
+bool greatestpp_async_wait_fd(int fd, uint32_t events,                  \
+                              std::coroutine_handle<> h) {              \
+    greatestpp_async_test *t =                                          \
+        &greatestpp_async.tests[greatestpp_async.current];              \
+    struct epoll_event ev;                                              \
+    memset(&ev, 0, sizeof(ev));                                         \
+    ev.events = events | EPOLLONESHOT;                                  \
+    ev.data.u64 = greatestpp_async.current;                             \
+    if (epoll_ctl(greatestpp_async.epfd, EPOLL_CTL_ADD, fd, &ev) != 0) { \
+        /* A regular file can't be polled, but it's always ready. Any   \
+         * other error, such as two tests waiting on the same FD, fails \
+         * the test once it has suspended. */                           \
+        if (errno == EPERM) return false;                               \
+        t->wait_error = errno;                                          \
+        return true;                                                    \
+    }                                                                   \
+    t->fd = fd;                                                         \
+    t->waiting = h;                                                     \
+    return true;                                                        \
+}                                                                       \
+                                                                        \
+void greatestpp_async_wait_until(uint64_t due_ns,                       \
+                                 std::coroutine_handle<> h) {           \
+    greatestpp_async_test *t =                                          \
+        &greatestpp_async.tests[greatestpp_async.current];              \
+    t->wake_ns = due_ns;                                                \
+    t->waiting = h;                                                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_async_finish(size_t i, int res) {                \
+    greatestpp_async_test *t = &greatestpp_async.tests[i];              \
+    GREATESTPP_SET_TIME(t->post_test);                                  \
+    t->post_test.cpu_ns = t->pre_test.cpu_ns + t->cpu_ns;               \
+    if (t->fd >= 0) {                                                   \
+        epoll_ctl(greatestpp_async.epfd, EPOLL_CTL_DEL, t->fd, NULL);   \
+        t->fd = -1;                                                     \
+    }                                                                   \
+    if (t->info.msg == greatestpp_fail_msg.c_str()) {                   \
+        t->msg_buf = greatestpp_fail_msg;                               \
+        t->info.msg = t->msg_buf.c_str();                               \
+    }                                                                   \
+    t->task = greatestpp_task();                                        \
+    if (t->teardown) t->teardown(t->teardown_udata);                    \
+    t->res = res;                                                       \
+    t->state = GREATESTPP_ASYNC_DONE;                                   \
+    greatestpp_async.running--;                                         \
+    if (res < 0) greatestpp_async.failed++;                             \
+}                                                                       \
+                                                                        \
+/* Fail a test with MSG, dropping its coroutine. */                     \
+static void greatestpp_async_abort(size_t i, const char *msg) {         \
+    greatestpp_async_test *t = &greatestpp_async.tests[i];              \
+    t->msg_buf = msg;                                                   \
+    t->info.msg = t->msg_buf.c_str();                                   \
+    t->info.fail_file = NULL;                                           \
+    t->info.fail_line = 0;                                              \
+    greatestpp_async_finish(i, -1);                                     \
+}                                                                       \
+                                                                        \
+/* Run test I until it next waits or finishes. */                       \
+static void greatestpp_async_resume(size_t i) {                         \
+    greatestpp_async_test *t = &greatestpp_async.tests[i];              \
+    std::coroutine_handle<> h = t->waiting;                             \
+    greatestpp_time before;                                             \
+    greatestpp_time after;                                              \
+    t->waiting = nullptr;                                               \
+    greatestpp_async.current = i;                                       \
+    greatestpp_test = t->info;                                          \
+    GREATESTPP_SET_TIME(before);                                        \
+    h.resume();                                                         \
+    GREATESTPP_SET_TIME(after);                                         \
+    t->cpu_ns += after.cpu_ns - before.cpu_ns;                          \
+    t->info = greatestpp_test;                                          \
+    if (t->task.handle.done()) {                                        \
+        greatestpp_async_finish(i, t->task.handle.promise().res);       \
+    } else if (t->wait_error) {                                         \
+        std::string msg("could not wait on an FD: ");                   \
+        msg += strerror(t->wait_error);                                 \
+        greatestpp_async_abort(i, msg.c_str());                         \
+    } else if (!t->waiting) {                                           \
+        greatestpp_async_abort(i, "suspended without waiting on an "    \
+            "FD or a timer");                                           \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_async_start(size_t i) {                          \
+    greatestpp_async_test *t = &greatestpp_async.tests[i];              \
+    GREATESTPP_SET_TIME(t->pre_test);                                   \
+    if (t->setup) t->setup(t->setup_udata);                             \
+    if (t->timeout_ms) {                                                \
+        t->deadline_ns = greatestpp_now_ns()                            \
+            + (uint64_t)t->timeout_ms * 1000000;                        \
+    }                                                                   \
+    t->state = GREATESTPP_ASYNC_RUNNING;                                \
+    greatestpp_async.running++;                                         \
+    greatestpp_async.current = i;                                       \
+    greatestpp_test = t->info;                                          \
+    t->task = t->start();                                               \
+    t->waiting = t->task.handle;                                        \
+    greatestpp_async_resume(i);                                         \
+}                                                                       \
+                                                                        \
+/* Run the current suite's async tests, up to --async at a time, and    \
+ * report them in the order they were queued. */                        \
+static void greatestpp_run_async(void) {                                \
+    greatestpp_async_loop *loop = &greatestpp_async;                    \
+    size_t n = loop->tests.size();                                      \
+    size_t next = 0;                                                    \
+    size_t reported = 0;                                                \
+    size_t i;                                                           \
+    char msg[64];                                                       \
+    if (n == 0) return;                                                 \
+    if (loop->epfd < 0) loop->epfd = epoll_create1(EPOLL_CLOEXEC);      \
+    if (loop->epfd < 0) {                                               \
+        fprintf(greatestpp_notes(), "epoll_create1: %s\n", strerror(errno)); \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    loop->running = 0;                                                  \
+    loop->failed = 0;                                                   \
+    for (;;) {                                                          \
+        struct epoll_event ev[64];                                      \
+        uint64_t due = UINT64_MAX;                                      \
+        uint64_t now;                                                   \
+        int timeout = -1;                                               \
+        int got, k;                                                     \
+        if (GREATESTPP_FIRST_FAIL() && loop->failed > 0) n = next;      \
+        while (next < n && loop->running < greatestpp_info.async_limit) { \
+            greatestpp_async_start(next++);                             \
+        }                                                               \
+        while (reported < n                                             \
+            && loop->tests[reported].state == GREATESTPP_ASYNC_DONE) {  \
+            greatestpp_async_test *t = &loop->tests[reported++];        \
+            greatestpp_record_test(t->name, t->res, &t->info,           \
+                t->pre_test, t->post_test);                             \
+        }                                                               \
+        if (reported == n) break;                                       \
+        if (loop->running == 0) continue;                               \
+        for (i = reported; i < next; i++) {                             \
+            const greatestpp_async_test *t = &loop->tests[i];           \
+            if (t->state != GREATESTPP_ASYNC_RUNNING) continue;         \
+            if (t->wake_ns && t->wake_ns < due) due = t->wake_ns;       \
+            if (t->deadline_ns && t->deadline_ns < due) due = t->deadline_ns; \
+        }                                                               \
+        if (due != UINT64_MAX) {                                        \
+            now = greatestpp_now_ns();                                  \
+            timeout = due <= now ? 0 : (int)((due - now + 999999) / 1000000); \
+        }                                                               \
+        got = epoll_wait(loop->epfd, ev, 64, timeout);                  \
+        if (got < 0 && errno != EINTR) {                                \
+            fprintf(greatestpp_notes(), "epoll_wait: %s\n", strerror(errno)); \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+        for (k = 0; k < got; k++) {                                     \
+            greatestpp_async_test *t = &loop->tests[ev[k].data.u64];    \
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, t->fd, NULL);          \
+            t->fd = -1;                                                 \
+            greatestpp_async_resume((size_t)ev[k].data.u64);            \
+        }                                                               \
+        now = greatestpp_now_ns();                                      \
+        for (i = reported; i < next; i++) {                             \
+            greatestpp_async_test *t = &loop->tests[i];                 \
+            if (t->state != GREATESTPP_ASYNC_RUNNING) continue;         \
+            if (t->wake_ns && t->wake_ns <= now) {                      \
+                t->wake_ns = 0;                                         \
+                greatestpp_async_resume(i);                             \
+            } else if (t->deadline_ns && t->deadline_ns <= now) {       \
+                snprintf(msg, sizeof(msg), "TIMEOUT after %u ms",       \
+                    t->timeout_ms);                                     \
+                greatestpp_async_abort(i, msg);                         \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+    loop->tests.clear();                                                \
+}
+#define GREATESTPP_ASYNC_GLOBALS                                        \
+greatestpp_async_loop greatestpp_async = { -1, {}, 0, 0, 0 };
+#else
+#define GREATESTPP_ASYNC_DEFS()                                         \
+static void greatestpp_run_async(void) {}
+#define GREATESTPP_ASYNC_GLOBALS
+#endif
+
+/* Include several function definitions in the main test file. */
+#define GREATESTPP_MAIN_DEFS()                                            \
+                                                                        \
+GREATESTPP_TIME_DEFS()                                                  \
+GREATESTPP_ALLOC_DEFS()                                                 \
+GREATESTPP_PERF_DEFS()                                                  \
+GREATESTPP_PROFILE_DEFS()                                               \
+GREATESTPP_MEMORY_DEFS()                                                \
+GREATESTPP_CORPUS_DEFS()                                                \
+GREATESTPP_JOURNAL_DEFS()                                               \
+                                                                        \
+/* FNV-1a hash, for looking up exact names. */                          \
+static uint64_t greatestpp_hash_more(uint64_t h, const char *name) {    \
+    while (*name != '\0') {                                             \
+        h ^= (unsigned char)*name++;                                    \
+        h *= 1099511628211ULL;                                          \
+    }                                                                   \
+    return h;                                                           \
+}                                                                       \
+                                                                        \
+static uint64_t greatestpp_hash(const char *name) {                     \
+    return greatestpp_hash_more(14695981039346656037ULL, name);         \
+}                                                                       \
+                                                                        \
+void greatestpp_add_filter(greatestpp_pattern_set *set, const char *pattern) { \
+    set->patterns.push_back(pattern);                                   \
+}                                                                       \
+                                                                        \
+/* Load patterns from a file, one per line. Lines starting with '!'     \
+ * are excludes and lines starting with '#' are comments. Returns 0     \
+ * if the file can't be read, or has a line that's too long or a '!'    \
+ * with no pattern, which would exclude every test. */                  \
+int greatestpp_load_filter_file(const char *path) {                     \
+    FILE *f = fopen(path, "r");                                         \
+    std::string line;                                                   \
+    int got;                                                            \
+    if (f == NULL) return 0;                                            \
+    while ((got = greatestpp_read_line(f, &line)) > 0) {                \
+        line.resize(strcspn(line.c_str(), "\r"));                       \
+        if (line.empty() || line[0] == '#') continue;                   \
+        if (line[0] == '!') {                                           \
+            if (line.size() == 1) {                                     \
+                got = -1;                                               \
+                break;                                                  \
+            }                                                           \
+            greatestpp_add_filter(&greatestpp_filter_info.tests.exclude, \
+                line.c_str() + 1);                                      \
+        } else {                                                        \
+            greatestpp_add_filter(&greatestpp_filter_info.tests.include, \
+                line.c_str());                                          \
+        }                                                               \
+    }                                                                   \
+    fclose(f);                                                          \
+    return got == 0;                                                    \
+}                                                                       \
+                                                                        \
+static uint32_t greatestpp_ac_next(const greatestpp_ac_state *state,    \
+                                   unsigned char c) {                   \
+    std::vector<std::pair<unsigned char, uint32_t> >::const_iterator it = \
+        std::lower_bound(state->next.begin(), state->next.end(),        \
+            std::make_pair(c, (uint32_t)0));                            \
+    return it != state->next.end() && it->first == c ? it->second : 0;  \
+}                                                                       \
+                                                                        \
+/* Build the Aho-Corasick automaton for the substring patterns. */      \
+static void greatestpp_ac_build(greatestpp_pattern_set *set) {          \
+    std::vector<greatestpp_ac_state> &ac = set->automaton;              \
+    std::vector<uint32_t> queue;                                        \
+    size_t i, j, head;                                                  \
+    ac.assign(1, greatestpp_ac_state());                                \
+    ac[0].fail = 0;                                                     \
+    ac[0].match = 0;                                                    \
+    for (i = 0; i < set->substrings.size(); i++) {                      \
+        const std::string &p = set->substrings[i];                      \
+        uint32_t cur = 0;                                               \
+        for (j = 0; j < p.size(); j++) {                                \
+            unsigned char c = (unsigned char)p[j];                      \
+            uint32_t next = 0;                                          \
+            size_t k;                                                   \
+            for (k = 0; k < ac[cur].next.size(); k++) {                 \
+                if (ac[cur].next[k].first == c) next = ac[cur].next[k].second; \
+            }                                                           \
+            if (next == 0) {                                            \
+                next = (uint32_t)ac.size();                             \
+                ac.push_back(greatestpp_ac_state());                    \
+                ac[next].fail = 0;                                      \
+                ac[next].match = 0;                                     \
+                ac[cur].next.push_back(std::make_pair(c, next));        \
+            }                                                           \
+            cur = next;                                                 \
+        }                                                               \
+        ac[cur].match = 1;                                              \
+    }                                                                   \
+    for (i = 0; i < ac.size(); i++) {                                   \
+        std::sort(ac[i].next.begin(), ac[i].next.end());                \
+    }                                                                   \
+    /* Breadth-first, so each state's fail link is set before its       \
+     * children's. */                                                   \
+    queue.push_back(0);                                                 \
+    for (head = 0; head < queue.size(); head++) {                       \
+        uint32_t u = queue[head];                                       \
+        for (i = 0; i < ac[u].next.size(); i++) {                       \
+            unsigned char c = ac[u].next[i].first;                      \
+            uint32_t v = ac[u].next[i].second;                          \
+            uint32_t f = ac[u].fail;                                    \
+            if (u != 0) {                                               \
+                while (f != 0 && greatestpp_ac_next(&ac[f], c) == 0) {  \
+                    f = ac[f].fail;                                     \
+                }                                                       \
+                f = greatestpp_ac_next(&ac[f], c);                      \
+            }                                                           \
+            ac[v].fail = f;                                             \
+            ac[v].match |= ac[f].match;                                 \
+            queue.push_back(v);                                         \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_compile_set(greatestpp_pattern_set *set) {       \
+    size_t i;                                                           \
+    for (i = 0; i < set->patterns.size(); i++) {                        \
+        const std::string &p = set->patterns[i];                        \
+        if (p[0] == '=') {                                              \
+            set->exact_index.insert(std::make_pair(                     \
+                greatestpp_hash(p.c_str() + 1), set->exact.size()));    \
+            set->exact.push_back(p.substr(1));                          \
+        } else if (p.find_first_of("*?[") != std::string::npos) {       \
+            set->globs.push_back(p);                                    \
+        } else {                                                        \
+            set->substrings.push_back(p);                               \
+        }                                                               \
+    }                                                                   \
+    if (!set->substrings.empty()) greatestpp_ac_build(set);             \
+}                                                                       \
+                                                                        \
+/* Compile all the filters, once all the patterns have been added. */   \
+void greatestpp_compile_filters(void) {                                 \
+    greatestpp_compile_set(&greatestpp_filter_info.suites.include);     \
+    greatestpp_compile_set(&greatestpp_filter_info.suites.exclude);     \
+    greatestpp_compile_set(&greatestpp_filter_info.tests.include);      \
+    greatestpp_compile_set(&greatestpp_filter_info.tests.exclude);      \
+}                                                                       \
+                                                                        \
+/* Does the bracket expression at PAT match C? Returns the rest of the  \
+ * pattern after it if so, otherwise NULL. */                           \
+static const char *greatestpp_glob_class(const char *pat, char c) {     \
+    const char *start;                                                  \
+    int negate = 0;                                                     \
+    int matched = 0;                                                    \
+    pat++;                                                              \
+    if (*pat == '!' || *pat == '^') {                                   \
+        negate = 1;                                                     \
+        pat++;                                                          \
+    }                                                                   \
+    start = pat;                                                        \
+    while (*pat != '\0' && (*pat != ']' || pat == start)) {             \
+        if (pat[1] == '-' && pat[2] != '\0' && pat[2] != ']') {         \
+            if (c >= pat[0] && c <= pat[2]) matched = 1;                \
+            pat += 3;                                                   \
+        } else {                                                        \
+            if (c == *pat) matched = 1;                                 \
+            pat++;                                                      \
+        }                                                               \
+    }                                                                   \
+    if (*pat != ']') return NULL;                                       \
+    return matched != negate ? pat + 1 : NULL;                          \
+}                                                                       \
+                                                                        \
+/* Match NAME against a glob with '*', '?' and '[...]'. */              \
+static int greatestpp_glob_match(const char *pat, const char *name) {   \
+    const char *star = NULL;                                            \
+    const char *retry = NULL;                                           \
+    while (*name != '\0') {                                             \
+        const char *next = NULL;                                        \
+        if (*pat == '*') {                                              \
+            star = ++pat;                                               \
+            retry = name;                                               \
+            continue;                                                   \
+        } else if (*pat == '?') {                                       \
+            next = pat + 1;                                             \
+        } else if (*pat == '[') {                                       \
+            next = greatestpp_glob_class(pat, *name);                   \
+        } else if (*pat != '\0' && *pat == *name) {                     \
+            next = pat + 1;                                             \
+        }                                                               \
+        if (next) {                                                     \
+            pat = next;                                                 \
+            name++;                                                     \
+        } else if (star) {                                              \
+            pat = star;                                                 \
+            name = ++retry;                                             \
+        } else {                                                        \
+            return 0;                                                   \
+        }                                                               \
+    }                                                                   \
+    while (*pat == '*') pat++;                                          \
+    return *pat == '\0';                                                \
+}                                                                       \
+                                                                        \
+static int greatestpp_set_match(const greatestpp_pattern_set *set,      \
+                                const char *name) {                     \
+    size_t i;                                                           \
+    if (!set->exact.empty()) {                                          \
+        typedef std::unordered_multimap<uint64_t, size_t>::const_iterator \
+            iter;                                                       \
+        std::pair<iter, iter> range =                                   \
+            set->exact_index.equal_range(greatestpp_hash(name));        \
+        for (iter it = range.first; it != range.second; ++it) {         \
+            if (set->exact[it->second] == name) return 1;               \
+        }                                                               \
+    }                                                                   \
+    if (!set->automaton.empty()) {                                      \
+        const std::vector<greatestpp_ac_state> &ac = set->automaton;    \
+        uint32_t cur = 0;                                               \
+        if (ac[0].match) return 1;                                      \
+        for (i = 0; name[i] != '\0'; i++) {                             \
+            unsigned char c = (unsigned char)name[i];                   \
+            uint32_t next = greatestpp_ac_next(&ac[cur], c);            \
+            while (next == 0 && cur != 0) {                             \
+                cur = ac[cur].fail;                                     \
+                next = greatestpp_ac_next(&ac[cur], c);                 \
+            }                                                           \
+            cur = next;                                                 \
+            if (ac[cur].match) return 1;                                \
+        }                                                               \
+    }                                                                   \
+    for (i = 0; i < set->globs.size(); i++) {                           \
+        if (greatestpp_glob_match(set->globs[i].c_str(), name)) return 1; \
+    }                                                                   \
+    return 0;                                                           \
+}                                                                       \
+                                                                        \
+int greatestpp_filter_match(const greatestpp_filter *filter, const char *name) { \
+    if (!filter->include.patterns.empty()                               \
+        && !greatestpp_set_match(&filter->include, name)) {             \
+        return 0;                                                       \
+    }                                                                   \
+    return filter->exclude.patterns.empty()                             \
+        || !greatestpp_set_match(&filter->exclude, name);               \
+}                                                                       \
+                                                                        \
+/* Is TAG one of the comma-separated TAGS? */                           \
+static int greatestpp_tag_match(const char *tags, const char *tag) {    \
+    size_t tag_len = strlen(tag);                                       \
+    while (tags != NULL && *tags != '\0') {                             \
+        const char *end = strchr(tags, ',');                            \
+        size_t len = end ? (size_t)(end - tags) : strlen(tags);         \
+        if (len == tag_len && 0 == strncmp(tags, tag, len)) return 1;   \
+        tags = end ? end + 1 : NULL;                                    \
+    }                                                                   \
+    return 0;                                                           \
+}                                                                       \
+                                                                        \
+/* Timeout for the test being started, in ms, or 0. */                  \
+static unsigned int greatestpp_timeout(void) {                          \
+    if (greatestpp_info.test_timeout_ms) {                              \
+        return greatestpp_info.test_timeout_ms;                         \
+    }                                                                   \
+    if (greatestpp_info.suite_timeout_ms) {                             \
+        return greatestpp_info.suite_timeout_ms;                        \
+    }                                                                   \
+    return greatestpp_info.timeout_ms;                                  \
+}                                                                       \
+                                                                        \
+/* Look up a test of the current suite in the --cache results. */       \
+static const greatestpp_cache_entry *greatestpp_cached(const char *name) { \
+    std::unordered_map<std::string, greatestpp_cache_entry>::const_iterator it; \
+    std::string key(greatestpp_info.suite.name);                        \
+    key += '\t';                                                        \
+    key += name;                                                        \
+    it = greatestpp_cache.find(key);                                    \
+    return it == greatestpp_cache.end() ? NULL : &it->second;           \
+}                                                                       \
+                                                                        \
+/* With --rerun-failed, only run tests that failed last time, unless    \
+ * none did. */                                                         \
+static int greatestpp_cache_match(const char *name) {                   \
+    const greatestpp_cache_entry *e;                                    \
+    if (!(greatestpp_info.flags & GREATESTPP_FLAG_RERUN_FAILED)         \
+        || greatestpp_info.cache_failures == 0) {                       \
+        return 1;                                                       \
+    }                                                                   \
+    e = greatestpp_cached(name);                                        \
+    return e != NULL && e->res < 0;                                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_watchdog_arm(const char *name, unsigned int ms,  \
+                                    size_t job);                        \
+static void greatestpp_watchdog_disarm(unsigned int ms);                \
+static void greatestpp_timeout_exit(const greatestpp_deadline *d);      \
+                                                                        \
+/* With --shard, is the test in this run's shard? Tests in the          \
+ * --shard-timings file go where it put them, others by name hash. */   \
+static int greatestpp_shard_match(const char *name) {                   \
+    uint64_t h;                                                         \
+    if (greatestpp_info.shard_count == 0) return 1;                     \
+    if (!greatestpp_shard_plan.empty()) {                               \
+        std::unordered_map<std::string, unsigned int>::const_iterator it; \
+        std::string key(greatestpp_info.suite.name);                    \
+        key += '\t';                                                    \
+        key += name;                                                    \
+        it = greatestpp_shard_plan.find(key);                           \
+        if (it != greatestpp_shard_plan.end()) {                        \
+            return it->second == greatestpp_info.shard_index;           \
+        }                                                               \
+    }                                                                   \
+    h = greatestpp_hash_more(greatestpp_hash_more(                      \
+        greatestpp_hash(greatestpp_info.suite.name), "\t"), name);      \
+    return h % greatestpp_info.shard_count == greatestpp_info.shard_index; \
+}                                                                       \
+                                                                        \
+/* Does the test pass the filters, and is it in this shard? */          \
+static int greatestpp_want_test(const char *name) {                     \
+    return !(GREATESTPP_BENCH_MODE()                                    \
+        || (GREATESTPP_FIRST_FAIL() && greatestpp_info.suite.failed > 0) \
+        || !greatestpp_filter_match(&greatestpp_filter_info.tests, name) \
+        || (greatestpp_info.tag_filter != NULL                          \
+            && !greatestpp_tag_match(greatestpp_info.test_tags,         \
+                greatestpp_info.tag_filter))                            \
+        || !greatestpp_cache_match(name)                                \
+        || !greatestpp_shard_match(name));                              \
+}                                                                       \
+                                                                        \
+/* Returns 1 to run the test now, 2 to queue it, 3 to only list it      \
+ * (with -l), or 0 if it's filtered out. */                             \
+int greatestpp_pre_test(const char *name) {                               \
+    if (!greatestpp_want_test(name)) return 0;                          \
+    if (GREATESTPP_LIST_ONLY()) return 3;                               \
+    if (greatestpp_info.jobs > 1 || greatestpp_info.forks > 0           \
+        || GREATESTPP_REORDER()) {                                      \
+        return 2;               /* queue it, for a worker or to reorder */ \
+    }                                                                   \
+    memset(&greatestpp_test, 0, sizeof(greatestpp_test));               \
+    greatestpp_watchdog_arm(name, greatestpp_timeout(), SIZE_MAX);      \
+    GREATESTPP_SET_TIME(greatestpp_info.suite.pre_test);                \
+    if (greatestpp_info.setup) {                                        \
+        greatestpp_info.setup(greatestpp_info.setup_udata);             \
+    }                                                                   \
+    greatestpp_memory_start();                                          \
+    greatestpp_perf_start();                                            \
+    GREATESTPP_ALLOC_BEGIN();                                           \
+    greatestpp_profile_start();                                         \
+    return 1;                   /* test should be run */                \
+}                                                                       \
+                                                                        \
+/* Copy S into a journal field of SIZE bytes, cutting it short. */      \
+static void greatestpp_journal_copy(char *field, size_t size,           \
+                                    const char *s) {                    \
+    size_t n = s ? strlen(s) : 0;                                       \
+    if (n >= size) n = size - 1;                                        \
+    if (n > 0) memcpy(field, s, n);                                     \
+    field[n] = '\0';                                                    \
+}                                                                       \
+                                                                        \
+/* Append a record to the --journal, if there is one. */                \
+static void greatestpp_journal_write(uint32_t kind, const char *name,  \
+        int res, const greatestpp_test_info *info,                      \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    greatestpp_journal_record *r;                                       \
+    if (!greatestpp_journal_out.active) return;                         \
+    r = greatestpp_journal_slot();                                      \
+    if (r == NULL) return;                                              \
+    r->res = res;                                                       \
+    r->fail_line = info ? info->fail_line : 0;                          \
+    r->start_ns = pre.wall_ns;                                          \
+    r->wall_ns = post.wall_ns - pre.wall_ns;                            \
+    r->cpu_ns = post.cpu_ns - pre.cpu_ns;                               \
+    greatestpp_journal_copy(r->suite, sizeof(r->suite),                 \
+        greatestpp_info.suite.name);                                    \
+    greatestpp_journal_copy(r->name, sizeof(r->name), name);            \
+    greatestpp_journal_copy(r->file, sizeof(r->file),                   \
+        info ? info->fail_file : NULL);                                 \
+    greatestpp_journal_copy(r->msg, sizeof(r->msg), info ? info->msg : NULL); \
+    greatestpp_journal_commit(r, kind);                                 \
+}                                                                       \
+                                                                        \
+/* Count and print a finished test's result. Only called from the       \
+ * main thread, in the order the tests were started. */                 \
+static void greatestpp_record_test(const char *name, int res,           \
+        const greatestpp_test_info *info,                               \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    greatestpp_journal_write(GREATESTPP_JOURNAL_TEST, name, res, info,  \
+        pre, post);                                                     \
+    if (res < 0) {                                                      \
+        greatestpp_info.suite.failed++;                                 \
+    } else if (res > 0) {                                               \
+        greatestpp_info.suite.skipped++;                                \
+    } else if (res == 0) {                                              \
+        greatestpp_info.suite.passed++;                                 \
+    }                                                                   \
+    greatestpp_info.suite.tests_run++;                                  \
+    greatestpp_info.reporter->test_end(name, res, info, pre, post);     \
+    /* Output is otherwise only flushed when the buffer fills up. */    \
+    if (res < 0) {                                                      \
+        fflush(GREATESTPP_STDOUT);                                      \
+        fflush(greatestpp_info.out);                                    \
+    }                                                                   \
+    if (greatestpp_info.flags & GREATESTPP_FLAG_TIMINGS) {              \
+        greatestpp_timing t;                                            \
+        t.suite = greatestpp_info.suite.name;                           \
+        t.name = name;                                                  \
+        t.res = res;                                                    \
+        t.wall_ns = post.wall_ns - pre.wall_ns;                         \
+        t.cpu_ns = post.cpu_ns - pre.cpu_ns;                            \
+        t.perf = info->perf;                                            \
+        t.mem = info->mem;                                              \
+        greatestpp_timings.push_back(t);                                \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+void greatestpp_post_test(const char *name, int res) {                    \
+    greatestpp_profile_stop();                                          \
+    GREATESTPP_ALLOC_END(greatestpp_test.allocs);                       \
+    greatestpp_perf_stop(&greatestpp_test.perf);                        \
+    greatestpp_memory_stop(&greatestpp_test.mem);                       \
+    GREATESTPP_SET_TIME(greatestpp_info.suite.post_test);                   \
+    if (greatestpp_info.teardown) {                                       \
+        void *udata = greatestpp_info.teardown_udata;                     \
+        greatestpp_info.teardown(udata);                                  \
+    }                                                                   \
+    greatestpp_watchdog_disarm(greatestpp_timeout());                   \
+    greatestpp_record_test(name, res, &greatestpp_test,                 \
+        greatestpp_info.suite.pre_test, greatestpp_info.suite.post_test); \
+    greatestpp_profile_write(name, greatestpp_info.suite.pre_test,      \
+        greatestpp_info.suite.post_test);                               \
+}                                                                       \
+                                                                        \
+void greatestpp_queue_test(const char *name,                            \
+                           std::function<int(void)> test) {             \
+    greatestpp_job job;                                                 \
+    job.name = name;                                                    \
+    job.test = test;                                                    \
+    job.setup = greatestpp_info.setup;                                  \
+    job.setup_udata = greatestpp_info.setup_udata;                      \
+    job.teardown = greatestpp_info.teardown;                            \
+    job.teardown_udata = greatestpp_info.teardown_udata;                \
+    job.timeout_ms = greatestpp_timeout();                              \
+    job.ran = 0;                                                        \
+    job.res = 0;                                                        \
+    memset(&job.info, 0, sizeof(job.info));                             \
+    memset(&job.pre_test, 0, sizeof(job.pre_test));                     \
+    memset(&job.post_test, 0, sizeof(job.post_test));                   \
+    greatestpp_workers.jobs.push_back(job);                             \
+}                                                                       \
+                                                                        \
+/* Run one queued test on the calling worker thread. */                 \
+static void greatestpp_run_job(size_t index) {                          \
+    greatestpp_job *job = &greatestpp_workers.jobs[index];              \
+    /* Forked workers are timed out by the parent instead. */           \
+    unsigned int timeout = greatestpp_info.forks ? 0 : job->timeout_ms; \
+    memset(&greatestpp_test, 0, sizeof(greatestpp_test));               \
+    greatestpp_watchdog_arm(job->name, timeout,                         \
+        greatestpp_info.jobs > 1 ? index : SIZE_MAX);                   \
+    GREATESTPP_SET_TIME(job->pre_test);                                 \
+    if (job->setup) job->setup(job->setup_udata);                       \
+    greatestpp_memory_start();                                          \
+    greatestpp_perf_start();                                            \
+    GREATESTPP_ALLOC_BEGIN();                                           \
+    greatestpp_profile_start();                                         \
+    job->res = job->test();                                             \
+    greatestpp_profile_stop();                                          \
+    GREATESTPP_ALLOC_END(greatestpp_test.allocs);                       \
+    greatestpp_perf_stop(&greatestpp_test.perf);                        \
+    greatestpp_memory_stop(&greatestpp_test.mem);                       \
+    GREATESTPP_SET_TIME(job->post_test);                                \
+    if (job->teardown) job->teardown(job->teardown_udata);              \
+    greatestpp_watchdog_disarm(timeout);                                \
+    job->info = greatestpp_test;                                        \
+    if (job->info.msg == greatestpp_fail_msg.c_str()) {                 \
+        /* The next test on this thread reuses the buffer. */           \
+        job->msg_buf = greatestpp_fail_msg;                             \
+        job->info.msg = job->msg_buf.c_str();                           \
+    }                                                                   \
+    if (job->res < 0 && GREATESTPP_FIRST_FAIL()) {                      \
+        size_t first = greatestpp_workers.first_fail;                   \
+        while (index < first &&                                         \
+            !greatestpp_workers.first_fail.compare_exchange_weak(first, \
+                index)) {}                                              \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Take the next job index: the front of our own queue, else steal      \
+ * from the back of another worker's. Returns 0 when all are empty. */  \
+static int greatestpp_pool_take(size_t id, size_t *index) {             \
+    size_t count = greatestpp_workers.queues.size();                    \
+    size_t i;                                                           \
+    for (i = 0; i < count; i++) {                                       \
+        greatestpp_worker_queue *q =                                    \
+            greatestpp_workers.queues[(id + i) % count].get();          \
+        std::lock_guard<std::mutex> guard(q->lock);                     \
+        if (q->jobs.empty()) continue;                                  \
+        if (i == 0) {                                                   \
+            *index = q->jobs.front();                                   \
+            q->jobs.pop_front();                                        \
+        } else {                                                        \
+            *index = q->jobs.back();                                    \
+            q->jobs.pop_back();                                         \
+        }                                                               \
+        return 1;                                                       \
+    }                                                                   \
+    return 0;                                                           \
+}                                                                       \
+                                                                        \
+/* Worker ID's loop, started when the pool's generation was SEEN. */    \
+static void greatestpp_worker_loop(size_t id, unsigned int seen) {      \
+    greatestpp_pool *pool = &greatestpp_workers;                        \
+    size_t index;                                                       \
+    for (;;) {                                                          \
+        {                                                               \
+            std::unique_lock<std::mutex> guard(pool->lock);             \
+            while (!pool->stop && pool->generation == seen) {           \
+                pool->wake.wait(guard);                                 \
+            }                                                           \
+            if (pool->stop) return;                                     \
+            seen = pool->generation;                                    \
+        }                                                               \
+        while (greatestpp_pool_take(id, &index)) {                      \
+            int ran = index < pool->first_fail;                         \
+            if (ran) greatestpp_run_job(index);                         \
+            std::lock_guard<std::mutex> guard(pool->lock);              \
+            pool->jobs[index].ran = ran;                                \
+            pool->remaining--;                                          \
+        }                                                               \
+        /* None of this suite's tests are left for this worker. Release \
+         * its suite fixtures before the suite can end. */              \
+        greatestpp_release_fixtures(GREATESTPP_SCOPE_SUITE);            \
+        {                                                               \
+            std::lock_guard<std::mutex> guard(pool->lock);              \
+            if (--pool->remaining == 0) pool->idle.notify_all();        \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+greatestpp_pool::~greatestpp_pool() {                                   \
+    {                                                                   \
+        std::lock_guard<std::mutex> guard(lock);                        \
+        stop = 1;                                                       \
+    }                                                                   \
+    wake.notify_all();                                                  \
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();      \
+}                                                                       \
+                                                                        \
+/* Run the current suite's queued tests on the worker threads. The      \
+ * pool grows to -j threads, but no more than a suite has tests. Between \
+ * suites the workers only wait on the generation, so new queues and    \
+ * threads can be added without the lock. */                            \
+static void greatestpp_run_threaded(void) {                             \
+    greatestpp_pool *pool = &greatestpp_workers;                        \
+    size_t want = greatestpp_info.jobs < pool->jobs.size()              \
+        ? greatestpp_info.jobs : pool->jobs.size();                     \
+    size_t i;                                                           \
+    for (i = pool->queues.size(); i < want; i++) {                      \
+        pool->queues.push_back(std::unique_ptr<greatestpp_worker_queue>( \
+            new greatestpp_worker_queue()));                            \
+    }                                                                   \
+    for (i = pool->threads.size(); i < want; i++) {                     \
+        pool->threads.push_back(std::thread(greatestpp_worker_loop, i,  \
+            pool->generation));                                         \
+    }                                                                   \
+    if (pool->threads.empty()) return;                                  \
+    for (i = 0; i < pool->jobs.size(); i++) {                           \
+        pool->queues[i % pool->queues.size()]->jobs.push_back(i);       \
+    }                                                                   \
+    {                                                                   \
+        std::unique_lock<std::mutex> guard(pool->lock);                 \
+        pool->first_fail = SIZE_MAX;                                    \
+        /* Each worker finishes once it runs out of jobs, too. */       \
+        pool->remaining = pool->jobs.size() + pool->threads.size();     \
+        pool->generation++;                                             \
+        pool->wake.notify_all();                                        \
+        while (pool->remaining > 0 && !pool->timed_out) {               \
+            pool->idle.wait(guard);                                     \
+        }                                                               \
+        if (pool->timed_out) greatestpp_timeout_exit(&pool->timeout);   \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+GREATESTPP_FORK_DEFS()                                                  \
+                                                                        \
+/* Reorder the current suite's queued tests by their cached results:    \
+ * last run's failures first with --failed-first, then the slowest      \
+ * first with --order=duration. Tests not in the cache count as slow,   \
+ * since nothing is known about them. */                                \
+static void greatestpp_order_jobs(void) {                               \
+    std::vector<greatestpp_job> &jobs = greatestpp_workers.jobs;        \
+    std::vector<std::pair<std::pair<int, uint64_t>, size_t> > keys;     \
+    std::vector<greatestpp_job> sorted;                                 \
+    size_t i;                                                           \
+    for (i = 0; i < jobs.size(); i++) {                                 \
+        const greatestpp_cache_entry *e = greatestpp_cached(jobs[i].name); \
+        int failed = e != NULL && e->res < 0;                           \
+        uint64_t wall = e != NULL ? e->wall_ns : UINT64_MAX;            \
+        if (!(greatestpp_info.flags & GREATESTPP_FLAG_FAILED_FIRST)) {  \
+            failed = 0;                                                 \
+        }                                                               \
+        if (!(greatestpp_info.flags & GREATESTPP_FLAG_ORDER_DURATION)) { \
+            wall = 0;                                                   \
+        }                                                               \
+        /* Negate so that an ascending sort puts them first. */         \
+        keys.push_back(std::make_pair(std::make_pair(-failed, ~wall), i)); \
+    }                                                                   \
+    std::stable_sort(keys.begin(), keys.end());                         \
+    sorted.reserve(jobs.size());                                        \
+    for (i = 0; i < keys.size(); i++) sorted.push_back(jobs[keys[i].second]); \
+    jobs.swap(sorted);                                                  \
+}                                                                       \
+                                                                        \
+/* Run the current suite's queued tests on the worker threads or        \
+ * processes, then merge their results into the suite in the order      \
+ * they were queued, so the output matches a serial run. */             \
+static void greatestpp_run_queued(void) {                               \
+    greatestpp_pool *pool = &greatestpp_workers;                        \
+    size_t i;                                                           \
+    if (pool->jobs.empty()) return;                                     \
+    if (GREATESTPP_REORDER()) greatestpp_order_jobs();                  \
+    if (greatestpp_info.forks > 0) {                                    \
+        greatestpp_run_forked();                                        \
+    } else if (greatestpp_info.jobs > 1) {                              \
+        greatestpp_run_threaded();                                      \
+    } else {                                                            \
+        /* Only queued to be reordered: run them here, reporting each   \
+         * as it finishes. */                                           \
+        for (i = 0; i < pool->jobs.size(); i++) {                       \
+            greatestpp_job *job = &pool->jobs[i];                       \
+            greatestpp_run_job(i);                                      \
+            greatestpp_record_test(job->name, job->res, &job->info,     \
+                job->pre_test, job->post_test);                         \
+            greatestpp_profile_write(job->name, job->pre_test,          \
+                job->post_test);                                        \
+            if (GREATESTPP_FAILURE_ABORT()) break;                      \
+        }                                                               \
+        pool->jobs.clear();                                             \
+        return;                                                         \
+    }                                                                   \
+    for (i = 0; i < pool->jobs.size(); i++) {                           \
+        greatestpp_job *job = &pool->jobs[i];                           \
+        if (!job->ran) break;                                           \
+        greatestpp_record_test(job->name, job->res, &job->info,         \
+            job->pre_test, job->post_test);                             \
+        if (GREATESTPP_FAILURE_ABORT()) break;                          \
+    }                                                                   \
+    pool->jobs.clear();                                                 \
+}                                                                       \
+                                                                        \
+int greatestpp_pre_bench(const char *name) {                            \
+    return GREATESTPP_BENCH_MODE() && !GREATESTPP_LIST_ONLY()           \
+        && (!GREATESTPP_FIRST_FAIL() || greatestpp_info.suite.failed == 0) \
+        && greatestpp_filter_match(&greatestpp_filter_info.tests, name) \
+        && (greatestpp_info.tag_filter == NULL ||                       \
+            greatestpp_tag_match(greatestpp_info.test_tags,             \
+                greatestpp_info.tag_filter));                           \
+}                                                                       \
+                                                                        \
+/* Time one run of BENCH, in ns per iteration. */                       \
+static int greatestpp_bench_sample(greatestpp_bench_cb *bench,          \
+        greatestpp_bench *b, double *ns, greatestpp_perf *perf) {       \
+    greatestpp_time t0;                                                 \
+    greatestpp_time t1;                                                 \
+    int res;                                                            \
+    GREATESTPP_SET_TIME(t0);                                            \
+    if (perf) greatestpp_perf_start();                                  \
+    res = bench(b);                                                     \
+    if (perf) greatestpp_perf_stop(perf);                               \
+    GREATESTPP_SET_TIME(t1);                                            \
+    *ns = (double)(t1.wall_ns - t0.wall_ns) / (double)b->iterations;    \
+    return res;                                                         \
+}                                                                       \
+                                                                        \
+static void greatestpp_bench_stats(greatestpp_bench_result *r) {        \
+    std::vector<double> sorted(r->samples);                             \
+    size_t n = sorted.size();                                           \
+    double sum = 0;                                                     \
+    double sq = 0;                                                      \
+    size_t i;                                                           \
+    std::sort(sorted.begin(), sorted.end());                            \
+    for (i = 0; i < n; i++) sum += sorted[i];                           \
+    r->mean = sum / n;                                                  \
+    for (i = 0; i < n; i++) sq += (sorted[i] - r->mean) * (sorted[i] - r->mean); \
+    r->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;                         \
+    r->median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2; \
+    r->min = sorted[0];                                                 \
+}                                                                       \
+                                                                        \
+/* Print a per-second rate, scaled to k/M/G. */                         \
+static void greatestpp_print_rate(double per_sec, const char *unit) {   \
+    const char *scale = "";                                             \
+    if (per_sec >= 1e9) {                                               \
+        per_sec /= 1e9;                                                 \
+        scale = "G";                                                    \
+    } else if (per_sec >= 1e6) {                                        \
+        per_sec /= 1e6;                                                 \
+        scale = "M";                                                    \
+    } else if (per_sec >= 1e3) {                                        \
+        per_sec /= 1e3;                                                 \
+        scale = "k";                                                    \
+    }                                                                   \
+    fprintf(greatestpp_notes(), ", %.2f %s%s/s", per_sec, scale, unit); \
+}                                                                       \
+                                                                        \
+/* Two-sided p-value of the Mann-Whitney U test that samples A and B    \
+ * come from the same distribution, using the normal approximation      \
+ * with a correction for ties. */                                       \
+static double greatestpp_mann_whitney(const std::vector<double> &a,     \
+                                      const std::vector<double> &b) {   \
+    std::vector<std::pair<double, int> > all;                           \
+    double na = (double)a.size();                                       \
+    double nb = (double)b.size();                                       \
+    double n = na + nb;                                                 \
+    double rank_a = 0;                                                  \
+    double ties = 0;                                                    \
+    double u, mean, var, z;                                             \
+    size_t i, j, k;                                                     \
+    for (i = 0; i < a.size(); i++) all.push_back(std::make_pair(a[i], 0)); \
+    for (i = 0; i < b.size(); i++) all.push_back(std::make_pair(b[i], 1)); \
+    std::sort(all.begin(), all.end());                                  \
+    for (i = 0; i < all.size(); i = j) {                                \
+        double t;                                                       \
+        for (j = i + 1; j < all.size() && all[j].first == all[i].first; j++) {} \
+        t = (double)(j - i);                                            \
+        ties += t * t * t - t;                                          \
+        for (k = i; k < j; k++) {                                       \
+            if (all[k].second == 0) rank_a += (i + 1 + j) / 2.0;        \
+        }                                                               \
+    }                                                                   \
+    u = rank_a - na * (na + 1) / 2;                                     \
+    mean = na * nb / 2;                                                 \
+    var = na * nb / 12 * ((n + 1) - ties / (n * (n - 1)));              \
+    if (var <= 0) return 1.0;                                           \
+    z = (fabs(u - mean) - 0.5) / sqrt(var);                             \
+    if (z < 0) z = 0;                                                   \
+    return erfc(z / sqrt(2.0));                                         \
+}                                                                       \
+                                                                        \
+/* Compare a finished benchmark against its --bench-compare baseline,   \
+ * and count it as a regression if it's significantly slower by more    \
+ * than --bench-threshold percent. */                                   \
+static void greatestpp_bench_compare(const greatestpp_bench_result *r) { \
+    const greatestpp_bench_baseline *base = NULL;                       \
+    greatestpp_bench_result old;                                        \
+    double change, p;                                                   \
+    const char *verdict = "no change";                                  \
+    size_t i;                                                           \
+    if (!greatestpp_info.bench_compare_file) return;                    \
+    for (i = 0; i < greatestpp_bench_baselines.size(); i++) {           \
+        if (greatestpp_bench_baselines[i].suite == r->suite             \
+            && greatestpp_bench_baselines[i].name == r->name) {         \
+            base = &greatestpp_bench_baselines[i];                      \
+            break;                                                      \
+        }                                                               \
+    }                                                                   \
+    if (base == NULL || base->samples.empty()) {                        \
+        fprintf(greatestpp_notes(), "    not in baseline\n");           \
+        return;                                                         \
+    }                                                                   \
+    old.samples = base->samples;                                        \
+    greatestpp_bench_stats(&old);                                       \
+    change = 100.0 * (r->median - old.median) / old.median;             \
+    p = greatestpp_mann_whitney(old.samples, r->samples);               \
+    if (p < GREATESTPP_BENCH_ALPHA                                      \
+        && change > greatestpp_info.bench_threshold) {                  \
+        verdict = "REGRESSION";                                         \
+        greatestpp_info.bench_regressions++;                            \
+    } else if (p < GREATESTPP_BENCH_ALPHA                               \
+        && change < -greatestpp_info.bench_threshold) {                 \
+        verdict = "improvement";                                        \
+    }                                                                   \
+    fprintf(greatestpp_notes(),                                         \
+        "    vs baseline: median %.3f -> %.3f ns/op (%+.1f%%, p=%.3f), %s\n", \
+        old.median, r->median, change, p, verdict);                     \
+}                                                                       \
+                                                                        \
+/* Run a benchmark: calibrate the iteration count until one sample      \
+ * takes about --bench-time ms (which also warms it up), then time      \
+ * --bench-samples samples and report their stats. */                   \
+void greatestpp_run_bench(const char *name, greatestpp_bench_cb *bench) { \
+    greatestpp_bench b;                                                 \
+    greatestpp_bench_result r;                                          \
+    greatestpp_time pre;                                                \
+    greatestpp_time post;                                               \
+    double target = greatestpp_info.bench_time_ms * 1e6;                \
+    double ns = 0;                                                      \
+    unsigned int i;                                                     \
+    int res;                                                            \
+    memset(&b, 0, sizeof(b));                                           \
+    memset(&greatestpp_test, 0, sizeof(greatestpp_test));               \
+    GREATESTPP_SET_TIME(pre);                                           \
+    if (greatestpp_info.setup) {                                        \
+        greatestpp_info.setup(greatestpp_info.setup_udata);             \
+    }                                                                   \
+    b.iterations = 1;                                                   \
+    for (;;) {                                                          \
+        double next;                                                    \
+        res = greatestpp_bench_sample(bench, &b, &ns, NULL);            \
+        if (res != 0 || ns * b.iterations >= target                     \
+            || b.iterations >= 1000000000000ULL) {                      \
+            break;                                                      \
+        }                                                               \
+        /* Aim a bit past the target, growing at most 100x per step. */ \
+        next = ns > 0 ? 1.4 * target / ns : 100.0 * b.iterations;       \
+        if (next > 100.0 * b.iterations) next = 100.0 * b.iterations;   \
+        b.iterations = next > b.iterations ? (uint64_t)next : b.iterations + 1; \
+    }                                                                   \
+    r.suite = greatestpp_info.suite.name;                               \
+    r.name = name;                                                      \
+    r.iterations = b.iterations;                                        \
+    memset(&r.perf, 0, sizeof(r.perf));                                 \
+    for (i = 0; res == 0 && i < greatestpp_info.bench_samples; i++) {   \
+        res = greatestpp_bench_sample(bench, &b, &ns, &r.perf);         \
+        r.samples.push_back(ns);                                        \
+    }                                                                   \
+    GREATESTPP_SET_TIME(post);                                          \
+    if (greatestpp_info.teardown) {                                     \
+        greatestpp_info.teardown(greatestpp_info.teardown_udata);       \
+    }                                                                   \
+    greatestpp_test.perf = r.perf;                                      \
+    greatestpp_record_test(name, res, &greatestpp_test, pre, post);     \
+    if (res != 0 || r.samples.empty()) return;                          \
+    r.bytes = b.bytes;                                                  \
+    r.items = b.items;                                                  \
+    greatestpp_bench_stats(&r);                                         \
+    fprintf(greatestpp_notes(),                                         \
+        "    %.3f ns/op (median %.3f, stddev %.3f, min %.3f), "         \
+        "%u x %llu iterations",                                         \
+        r.mean, r.median, r.stddev, r.min, (unsigned int)r.samples.size(), \
+        (unsigned long long)r.iterations);                              \
+    if (r.bytes) greatestpp_print_rate(r.bytes * 1e9 / r.median, "B");  \
+    if (r.items) greatestpp_print_rate(r.items * 1e9 / r.median, " items"); \
+    fprintf(greatestpp_notes(), "\n");                                  \
+    if (greatestpp_info.flags & GREATESTPP_FLAG_PERF) {                 \
+        double ops = (double)r.iterations * r.samples.size();           \
+        fprintf(greatestpp_notes(), "    %.1f cycles/op, "              \
+            "%.1f instructions/op (IPC %.2f), %.3f branch misses/op, "  \
+            "%.3f cache misses/op\n",                                   \
+            r.perf.cycles / ops, r.perf.instructions / ops,             \
+            r.perf.cycles ? (double)r.perf.instructions / r.perf.cycles : 0, \
+            r.perf.branch_misses / ops, r.perf.cache_misses / ops);     \
+    }                                                                   \
+    greatestpp_bench_compare(&r);                                       \
+    greatestpp_bench_results.push_back(r);                              \
+}                                                                       \
+                                                                        \
+/* Smallest time between two reads of the clock, taken off each of     \
+ * ASSERT_P99_UNDER's single-call samples. */                           \
+static double greatestpp_clock_overhead(void) {                         \
+    double best = 0;                                                    \
+    int i;                                                              \
+    for (i = 0; i < 64; i++) {                                          \
+        uint64_t start = greatestpp_now_ns();                           \
+        double ns = (double)(greatestpp_now_ns() - start);              \
+        if (i == 0 || ns < best) best = ns;                             \
+    }                                                                   \
+    return best;                                                        \
+}                                                                       \
+                                                                        \
+/* Call FN until warmed up, about a tenth of an attempt's time or       \
+ * 1000 calls, and return its mean time per call. */                    \
+static double greatestpp_warm_up(greatestpp_sample_cb *sample, void *fn) { \
+    double budget = GREATESTPP_LATENCY_TIME_MS * 1e6 / 10;              \
+    double spent = 0;                                                   \
+    double ns;                                                          \
+    uint64_t calls = 0;                                                 \
+    uint64_t batch = 1;                                                 \
+    while (spent < budget && calls < 1000) {                            \
+        sample(fn, batch, &ns, 1);                                      \
+        spent += ns * batch;                                            \
+        calls += batch;                                                 \
+        batch *= 2;                                                     \
+    }                                                                   \
+    return spent / calls;                                               \
+}                                                                       \
+                                                                        \
+/* Samples for an attempt lasting about GREATESTPP_LATENCY_TIME_MS      \
+ * with calls taking PER_CALL ns, within [LO, HI]. */                   \
+static size_t greatestpp_latency_samples(double per_call, size_t lo,    \
+                                         size_t hi) {                   \
+    double n = GREATESTPP_LATENCY_TIME_MS * 1e6 / (per_call > 1 ? per_call : 1); \
+    if (n < lo) return lo;                                              \
+    if (n > hi) return hi;                                              \
+    return (size_t)n;                                                   \
+}                                                                       \
+                                                                        \
+/* The nearest-rank percentile P of the sorted samples NS. */           \
+static double greatestpp_percentile(const std::vector<double> &ns,      \
+                                    double p) {                         \
+    size_t rank = (size_t)ceil(p * ns.size());                          \
+    return ns[rank > 0 ? rank - 1 : 0];                                 \
+}                                                                       \
+                                                                        \
+static void greatestpp_latency_stats(std::vector<double> &ns,           \
+        double overhead, greatestpp_latency *l) {                       \
+    size_t i;                                                           \
+    std::sort(ns.begin(), ns.end());                                    \
+    for (i = 0; i < ns.size(); i++) {                                   \
+        ns[i] = ns[i] > overhead ? ns[i] - overhead : 0;                \
+    }                                                                   \
+    l->samples = ns.size();                                             \
+    l->min = ns.front();                                                \
+    l->p50 = greatestpp_percentile(ns, 0.50);                           \
+    l->p90 = greatestpp_percentile(ns, 0.90);                           \
+    l->p99 = greatestpp_percentile(ns, 0.99);                           \
+    l->max = ns.back();                                                 \
+}                                                                       \
+                                                                        \
+/* ASSERT_P99_UNDER: time single calls to FN, and fail with the         \
+ * distribution from the best attempt if none has a p99 under LIMIT_NS. */ \
+int greatestpp_check_p99(const char *msg, const char *file,             \
+                         unsigned int line, double limit_ns,            \
+                         greatestpp_sample_cb *sample, void *fn) {      \
+    std::vector<double> ns;                                             \
+    greatestpp_latency l;                                               \
+    greatestpp_latency best;                                            \
+    double overhead = greatestpp_clock_overhead();                      \
+    size_t n = greatestpp_latency_samples(greatestpp_warm_up(sample, fn), \
+        100, 100000);                                                   \
+    char buf[256];                                                      \
+    unsigned int attempt;                                               \
+    for (attempt = 1; attempt <= GREATESTPP_LATENCY_ATTEMPTS; attempt++) { \
+        ns.resize(n);                                                   \
+        sample(fn, 1, &ns[0], n);                                       \
+        greatestpp_latency_stats(ns, overhead, &l);                     \
+        if (l.p99 < limit_ns) return 0;                                 \
+        if (attempt == 1 || l.p99 < best.p99) best = l;                 \
+        n *= 2;                                                         \
+    }                                                                   \
+    snprintf(buf, sizeof(buf), ": p99 %.1f ns, over %.1f ns "           \
+        "(min %.1f, p50 %.1f, p90 %.1f, max %.1f ns; %lu samples; "     \
+        "best of %u attempts)",                                         \
+        best.p99, limit_ns, best.min, best.p50, best.p90, best.max,     \
+        (unsigned long)best.samples, GREATESTPP_LATENCY_ATTEMPTS);      \
+    greatestpp_fail_msg = msg ? msg : "";                               \
+    greatestpp_fail_msg += buf;                                         \
+    greatestpp_fail_at(greatestpp_fail_msg.c_str(), file, line);        \
+    return -1;                                                          \
+}                                                                       \
+                                                                        \
+/* ASSERT_FASTER_THAN: time interleaved batches of calls to FAST and    \
+ * SLOW, each batch long enough for the clock's overhead not to count. */ \
+int greatestpp_check_faster(const char *msg, const char *file,          \
+                            unsigned int line, double ratio,            \
+                            greatestpp_sample_cb *fast_sample, void *fast, \
+                            greatestpp_sample_cb *slow_sample, void *slow) { \
+    std::vector<double> f;                                              \
+    std::vector<double> s;                                              \
+    double fast_ns = greatestpp_warm_up(fast_sample, fast);             \
+    double slow_ns = greatestpp_warm_up(slow_sample, slow);             \
+    uint64_t fast_batch = fast_ns < 1e4 ? (uint64_t)(1e4 / (fast_ns + 1)) + 1 : 1; \
+    uint64_t slow_batch = slow_ns < 1e4 ? (uint64_t)(1e4 / (slow_ns + 1)) + 1 : 1; \
+    size_t n = greatestpp_latency_samples(                              \
+        fast_ns * fast_batch + slow_ns * slow_batch, 11, 10000);        \
+    double best = 0;                                                    \
+    double best_f = 0;                                                  \
+    double best_s = 0;                                                  \
+    size_t best_n = 0;                                                  \
+    char buf[256];                                                      \
+    unsigned int attempt;                                               \
+    size_t i;                                                           \
+    for (attempt = 1; attempt <= GREATESTPP_LATENCY_ATTEMPTS; attempt++) { \
+        double got;                                                     \
+        f.resize(n);                                                    \
+        s.resize(n);                                                    \
+        for (i = 0; i < n; i++) {                                       \
+            fast_sample(fast, fast_batch, &f[i], 1);                    \
+            slow_sample(slow, slow_batch, &s[i], 1);                    \
+        }                                                               \
+        std::sort(f.begin(), f.end());                                  \
+        std::sort(s.begin(), s.end());                                  \
+        got = greatestpp_percentile(s, 0.5) / greatestpp_percentile(f, 0.5); \
+        if (got >= ratio) return 0;                                     \
+        if (attempt == 1 || got > best) {                               \
+            best = got;                                                 \
+            best_f = greatestpp_percentile(f, 0.5);                     \
+            best_s = greatestpp_percentile(s, 0.5);                     \
+            best_n = n;                                                 \
+        }                                                               \
+        n *= 2;                                                         \
+    }                                                                   \
+    snprintf(buf, sizeof(buf), ": %.2fx as fast, wanted %.2fx "         \
+        "(median %.1f vs %.1f ns per call; %lu samples of %llu and "    \
+        "%llu calls; best of %u attempts)",                             \
+        best, ratio, best_f, best_s, (unsigned long)best_n,             \
+        (unsigned long long)fast_batch, (unsigned long long)slow_batch, \
+        GREATESTPP_LATENCY_ATTEMPTS);                                   \
+    greatestpp_fail_msg = msg ? msg : "";                               \
+    greatestpp_fail_msg += buf;                                         \
+    greatestpp_fail_at(greatestpp_fail_msg.c_str(), file, line);        \
+    return -1;                                                          \
+}                                                                       \
+                                                                        \
+/* One thread of a stress test: its operation count and, if it failed   \
+ * or skipped, why. */                                                  \
+struct greatestpp_stress_thread {                                       \
+    greatestpp_stress s;                                                \
+    uint64_t ops;                                                       \
+    uint64_t end_ns;                                                    \
+    int res;                                                            \
+    greatestpp_test_info info;                                          \
+    std::string msg;                                                    \
+};                                                                      \
+                                                                        \
+int greatestpp_run_stress(greatestpp_stress_cb *body, unsigned int threads, \
+                          uint64_t iterations) {                        \
+    std::vector<greatestpp_stress_thread> st;                           \
+    std::vector<std::thread> pool;                                      \
+    std::atomic<unsigned int> ready(0);                                 \
+    std::atomic<bool> go(false);                                        \
+    std::atomic<bool> stop(false);                                      \
+    std::atomic<int> first(-1);                                         \
+    unsigned int failed = 0, skipped = 0, i;                            \
+    uint64_t start_ns, end_ns = 0, total = 0;                           \
+    double sum = 0, sq = 0, lo = 0, hi = 0, secs;                       \
+    char buf[256];                                                      \
+    if (threads == 0) threads = std::thread::hardware_concurrency();    \
+    if (threads == 0) threads = 1;                                      \
+    st.resize(threads);                                                 \
+    for (i = 0; i < threads; i++) {                                     \
+        greatestpp_stress_thread *t = &st[i];                           \
+        t->s.thread = i;                                                \
+        t->s.threads = threads;                                         \
+        t->s.iteration = 0;                                             \
+        t->ops = 0;                                                     \
+        t->res = 0;                                                     \
+        pool.push_back(std::thread([&, t, i]() {                        \
+            memset(&greatestpp_test, 0, sizeof(greatestpp_test));       \
+            ready++;                                                    \
+            /* Spin rather than block, so all start at once. */         \
+            while (!go.load(std::memory_order_acquire)) {               \
+                std::this_thread::yield();                              \
+            }                                                           \
+            while (!stop.load(std::memory_order_relaxed)                \
+                && (iterations == 0 || t->ops < iterations)) {          \
+                t->res = body(&t->s);                                   \
+                if (t->res != 0) break;                                 \
+                t->ops++;                                               \
+                t->s.iteration++;                                       \
+            }                                                           \
+            t->end_ns = greatestpp_now_ns();                            \
+            if (t->res < 0) {                                           \
+                int none = -1;                                          \
+                first.compare_exchange_strong(none, (int)i);            \
+                stop.store(true);                                       \
+            }                                                           \
+            if (t->res != 0) {                                          \
+                t->info = greatestpp_test;                              \
+                t->msg = greatestpp_test.msg ? greatestpp_test.msg : ""; \
+            }                                                           \
+        }));                                                            \
+        if (greatestpp_info.flags & GREATESTPP_FLAG_STRESS_PIN) {       \
+            greatestpp_pin_thread(pool.back(), i);                      \
+        }                                                               \
+    }                                                                   \
+    while (ready.load() < threads) std::this_thread::yield();           \
+    start_ns = greatestpp_now_ns();                                     \
+    go.store(true, std::memory_order_release);                          \
+    if (iterations == 0) {                                              \
+        uint64_t until = start_ns                                       \
+            + (uint64_t)greatestpp_info.stress_time_ms * 1000000;       \
+        while (!stop.load() && greatestpp_now_ns() < until) {           \
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));  \
+        }                                                               \
+        stop.store(true);                                               \
+    }                                                                   \
+    for (i = 0; i < threads; i++) pool[i].join();                       \
+    for (i = 0; i < threads; i++) {                                     \
+        const greatestpp_stress_thread *t = &st[i];                     \
+        double rate = (double)t->ops * 1e9                              \
+            / (double)(t->end_ns > start_ns ? t->end_ns - start_ns : 1); \
+        if (t->res < 0) failed++;                                       \
+        if (t->res > 0) skipped++;                                      \
+        if (t->end_ns > end_ns) end_ns = t->end_ns;                     \
+        total += t->ops;                                                \
+        sum += rate;                                                    \
+        sq += rate * rate;                                              \
+        if (i == 0 || rate < lo) lo = rate;                             \
+        if (i == 0 || rate > hi) hi = rate;                             \
+    }                                                                   \
+    if (failed > 0) {                                                   \
+        const greatestpp_stress_thread *t = &st[first.load()];          \
+        snprintf(buf, sizeof(buf), "thread %d of %u (%u failed), "      \
+            "after %llu calls: ", first.load(), threads, failed,        \
+            (unsigned long long)t->ops);                                \
+        greatestpp_fail_msg = buf + t->msg;                             \
+        greatestpp_fail_at(greatestpp_fail_msg.c_str(), t->info.fail_file, \
+            t->info.fail_line);                                         \
+        return -1;                                                      \
+    }                                                                   \
+    if (skipped > 0) {                                                  \
+        for (i = 0; st[i].res == 0; i++) {}                             \
+        greatestpp_fail_msg = st[i].msg;                                \
+        greatestpp_test.msg = greatestpp_fail_msg.c_str();              \
+        return 1;                                                       \
+    }                                                                   \
+    secs = (double)(end_ns - start_ns) / 1e9;                           \
+    snprintf(buf, sizeof(buf), "%.0f ops/s on %u threads (%.0f to %.0f " \
+        "per thread), fairness %.3f", (double)total / secs, threads,    \
+        lo, hi, sq > 0 ? sum * sum / (threads * sq) : 1.0);             \
+    greatestpp_fail_msg = buf;                                          \
+    greatestpp_test.msg = greatestpp_fail_msg.c_str();                  \
+    return 0;                                                           \
+}                                                                       \
+                                                                        \
+GREATESTPP_ASYNC_DEFS()                                                 \
+                                                                        \
+/* Report the end of the current suite and add it to the totals. */     \
+static void greatestpp_report_suite(void) {                             \
+    greatestpp_info.reporter->suite_end(greatestpp_info.suite.name);    \
+    fflush(GREATESTPP_STDOUT);                                          \
+    fflush(greatestpp_info.out);                                        \
+    greatestpp_info.passed += greatestpp_info.suite.passed;             \
+    greatestpp_info.failed += greatestpp_info.suite.failed;             \
+    greatestpp_info.skipped += greatestpp_info.suite.skipped;           \
+    greatestpp_info.tests_run += greatestpp_info.suite.tests_run;       \
+}                                                                       \
+                                                                        \
+static void greatestpp_end_suite(void) {                                \
+    GREATESTPP_SET_PROCESS_TIME(greatestpp_info.suite.post_suite);      \
+    greatestpp_journal_write(GREATESTPP_JOURNAL_SUITE,                  \
+        greatestpp_info.suite.name, 0, NULL,                            \
+        greatestpp_info.suite.pre_suite, greatestpp_info.suite.post_suite); \
+    greatestpp_report_suite();                                          \
+}                                                                       \
+                                                                        \
+static void greatestpp_run_suite(greatestpp_suite_cb *suite_cb,         \
+                                 const char *suite_name) {              \
+    if (!greatestpp_filter_match(&greatestpp_filter_info.suites,        \
+            suite_name))                                                \
+        return;                                                         \
+    if (GREATESTPP_FIRST_FAIL() && greatestpp_info.failed > 0) return;  \
+    memset(&greatestpp_info.suite, 0, sizeof(greatestpp_info.suite));   \
+    greatestpp_info.suite.name = suite_name;                            \
+    greatestpp_info.col = 0;                                              \
+    greatestpp_info.reporter->suite_begin(suite_name);                  \
+    GREATESTPP_SET_PROCESS_TIME(greatestpp_info.suite.pre_suite);       \
+    suite_cb();                                                         \
+    greatestpp_run_queued();                                            \
+    greatestpp_run_async();                                             \
+    greatestpp_end_suite();                                             \
+    greatestpp_release_fixtures(GREATESTPP_SCOPE_SUITE);                \
+    greatestpp_info.setup = NULL;                                         \
+    greatestpp_info.setup_udata = NULL;                                   \
+    greatestpp_info.teardown = NULL;                                      \
+    greatestpp_info.teardown_udata = NULL;                                \
+    greatestpp_info.suite_timeout_ms = 0;                               \
+}                                                                       \
+                                                                        \
+/* A test missed its deadline and can't be stopped: report the -j jobs  \
+ * queued before it that have finished, then it as a failure, finish    \
+ * the report as it stands, and exit. Called on the main thread with    \
+ * the pool locked for a -j job, else by the watchdog, with the main    \
+ * thread stuck in the test, so nothing else can report anything. */    \
+static void greatestpp_timeout_exit(const greatestpp_deadline *d) {     \
+    static char msg[64];                                                \
+    greatestpp_test_info info;                                          \
+    greatestpp_time post = d->start;                                    \
+    greatestpp_time now;                                                \
+    size_t i;                                                           \
+    for (i = 0; d->job != SIZE_MAX && i < d->job; i++) {                \
+        greatestpp_job *job = &greatestpp_workers.jobs[i];              \
+        if (!job->ran) continue;                                        \
+        greatestpp_record_test(job->name, job->res, &job->info,         \
+            job->pre_test, job->post_test);                             \
+    }                                                                   \
+    memset(&info, 0, sizeof(info));                                     \
+    snprintf(msg, sizeof(msg), "TIMEOUT after %u ms", d->timeout_ms);   \
+    info.msg = msg;                                                     \
+    info.fail_file = NULL;                                              \
+    GREATESTPP_SET_TIME(now);                                           \
+    post.wall_ns = now.wall_ns;                                         \
+    greatestpp_record_test(d->name, -1, &info, d->start, post);         \
+    greatestpp_end_suite();                                             \
+    GREATESTPP_SET_PROCESS_TIME(greatestpp_info.end);                   \
+    greatestpp_info.reporter->run_end();                                \
+    greatestpp_report_timings();                                        \
+    greatestpp_save_cache();                                            \
+    greatestpp_close_journal();                                         \
+    greatestpp_close_report();                                          \
+    _Exit(EXIT_FAILURE);                                                \
+}                                                                       \
+                                                                        \
+static void greatestpp_watchdog_loop(void) {                            \
+    greatestpp_watchdog *w = &greatestpp_watch;                         \
+    std::unique_lock<std::mutex> guard(w->lock);                        \
+    while (!w->stop) {                                                  \
+        size_t i, first = 0;                                            \
+        if (w->armed.empty()) {                                         \
+            w->wake.wait(guard);                                        \
+            continue;                                                   \
+        }                                                               \
+        for (i = 1; i < w->armed.size(); i++) {                         \
+            if (w->armed[i].due < w->armed[first].due) first = i;       \
+        }                                                               \
+        if (std::chrono::steady_clock::now() < w->armed[first].due) {   \
+            w->wake.wait_until(guard, w->armed[first].due);             \
+            continue;                                                   \
+        }                                                               \
+        if (w->armed[first].job == SIZE_MAX) {                          \
+            greatestpp_timeout_exit(&w->armed[first]);                  \
+        }                                                               \
+        /* Hand a -j job over to the main thread, which is waiting for  \
+         * the pool and reports the jobs' results. */                   \
+        {                                                               \
+            greatestpp_pool *pool = &greatestpp_workers;                \
+            greatestpp_deadline d = w->armed[first];                    \
+            w->armed[first] = w->armed.back();                          \
+            w->armed.pop_back();                                        \
+            guard.unlock();                                             \
+            {                                                           \
+                std::lock_guard<std::mutex> pool_guard(pool->lock);     \
+                if (!pool->timed_out) pool->timeout = d;                \
+                pool->timed_out = 1;                                    \
+            }                                                           \
+            pool->idle.notify_all();                                    \
+            guard.lock();                                               \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Give the calling thread's test MS ms to finish, if MS isn't 0. */    \
+static void greatestpp_watchdog_arm(const char *name, unsigned int ms,  \
+                                    size_t job) {                       \
+    greatestpp_watchdog *w = &greatestpp_watch;                         \
+    greatestpp_deadline d;                                              \
+    size_t i;                                                           \
+    bool nearest = true;                                                \
+    if (ms == 0) return;                                                \
+    d.thread = std::this_thread::get_id();                              \
+    d.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms); \
+    d.name = name;                                                      \
+    d.job = job;                                                        \
+    d.timeout_ms = ms;                                                  \
+    GREATESTPP_SET_TIME(d.start);                                       \
+    std::lock_guard<std::mutex> guard(w->lock);                         \
+    if (!w->thread.joinable()) {                                        \
+        w->thread = std::thread(greatestpp_watchdog_loop);              \
+    }                                                                   \
+    for (i = 0; i < w->armed.size(); i++) {                             \
+        if (w->armed[i].due <= d.due) nearest = false;                  \
+    }                                                                   \
+    w->armed.push_back(d);                                              \
+    /* The watchdog only needs waking if it's sleeping for too long. */ \
+    if (nearest) w->wake.notify_one();                                  \
+}                                                                       \
+                                                                        \
+static void greatestpp_watchdog_disarm(unsigned int ms) {               \
+    greatestpp_watchdog *w = &greatestpp_watch;                         \
+    std::thread::id self = std::this_thread::get_id();                  \
+    size_t i;                                                           \
+    if (ms == 0) return;                                                \
+    std::lock_guard<std::mutex> guard(w->lock);                         \
+    for (i = 0; i < w->armed.size(); i++) {                             \
+        if (w->armed[i].thread == self) {                               \
+            w->armed[i] = w->armed.back();                              \
+            w->armed.pop_back();                                        \
+            break;                                                      \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+greatestpp_watchdog::~greatestpp_watchdog() {                           \
+    {                                                                   \
+        std::lock_guard<std::mutex> guard(lock);                        \
+        stop = true;                                                    \
+    }                                                                   \
+    wake.notify_one();                                                  \
+    if (thread.joinable()) thread.join();                               \
+}                                                                       \
+                                                                        \
+std::vector<greatestpp_test_desc> &greatestpp_registry(void) {          \
+    static std::vector<greatestpp_test_desc> registry;                  \
+    return registry;                                                    \
+}                                                                       \
+                                                                        \
+/* Suite function for registered tests: runs the current suite's        \
+ * slice of the registry. */                                            \
+static void greatestpp_run_registered_suite(void) {                     \
+    std::vector<greatestpp_test_desc> &registry = greatestpp_registry(); \
+    size_t i;                                                           \
+    for (i = greatestpp_info.registered_begin;                          \
+         i < greatestpp_info.registered_end; i++) {                     \
+        const greatestpp_test_desc *desc = &registry[i];                \
+        greatestpp_info.test_tags = desc->tags;                         \
+        GREATESTPP_RUN_CALL(desc->name, desc->test());                  \
+    }                                                                   \
+    greatestpp_info.test_tags = NULL;                                   \
+}                                                                       \
+                                                                        \
+/* Sort the registry so each suite's tests are contiguous, with         \
+ * suites in the order they were first registered, then run them. */    \
+void greatestpp_run_registered(void) {                                  \
+    std::vector<greatestpp_test_desc> &registry = greatestpp_registry(); \
+    std::vector<const char *> suites;                                   \
+    std::vector<std::pair<size_t, size_t> > order;                      \
+    std::vector<greatestpp_test_desc> sorted;                           \
+    size_t i, j;                                                        \
+    for (i = 0; i < registry.size(); i++) {                             \
+        for (j = 0; j < suites.size(); j++) {                           \
+            if (0 == strcmp(suites[j], registry[i].suite)) break;       \
+        }                                                               \
+        if (j == suites.size()) suites.push_back(registry[i].suite);    \
+        order.push_back(std::make_pair(j, i));                          \
+    }                                                                   \
+    std::sort(order.begin(), order.end());                              \
+    for (i = 0; i < order.size(); i++) {                                \
+        sorted.push_back(registry[order[i].second]);                    \
+    }                                                                   \
+    registry.swap(sorted);                                              \
+    for (i = 0; i < registry.size(); i = j) {                           \
+        for (j = i; j < registry.size()                                 \
+            && 0 == strcmp(registry[j].suite, registry[i].suite); j++) {} \
+        greatestpp_info.registered_begin = i;                           \
+        greatestpp_info.registered_end = j;                             \
+        greatestpp_run_suite(greatestpp_run_registered_suite,           \
+            registry[i].suite);                                         \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Console reporter: the ".....F" output, or a line per test with -v. */ \
+static void greatestpp_console_run_begin(void) {}                       \
+                                                                        \
+static void greatestpp_console_suite_begin(const char *suite_name) {    \
+    fprintf(GREATESTPP_STDOUT, "\n* Suite %s:\n", suite_name);          \
+}                                                                       \
+                                                                        \
+static void greatestpp_console_test_end(const char *name, int res,      \
+        const greatestpp_test_info *info,                               \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    if (res < 0) {                                                      \
+        greatestpp_do_fail(name, info);                                 \
+    } else if (res > 0) {                                               \
+        greatestpp_do_skip(name, info);                                 \
+    } else {                                                            \
+        greatestpp_do_pass(name, info);                                 \
+    }                                                                   \
+    greatestpp_info.col++;                                              \
+    if (GREATESTPP_IS_VERBOSE()) {                                      \
+        GREATESTPP_CLOCK_DIFF(pre, post);                               \
+        if (greatestpp_info.flags & GREATESTPP_FLAG_PERF) {             \
+            const greatestpp_perf *p = &info->perf;                     \
+            fprintf(GREATESTPP_STDOUT, " [%llu cycles, %llu instructions, " \
+                "%llu branch misses, %llu cache misses]",               \
+                (unsigned long long)p->cycles,                          \
+                (unsigned long long)p->instructions,                    \
+                (unsigned long long)p->branch_misses,                   \
+                (unsigned long long)p->cache_misses);                   \
+        }                                                               \
+        if (info->mem.sampled                                           \
+            && (greatestpp_info.flags & GREATESTPP_FLAG_MEMORY)) {      \
+            const greatestpp_memory *m = &info->mem;                    \
+            fprintf(GREATESTPP_STDOUT, " [RSS %+lld kB, peak %llu kB, " \
+                "%llu minor and %llu major faults]",                    \
+                (long long)(m->end_kb - m->start_kb),                   \
+                (unsigned long long)m->peak_kb,                         \
+                (unsigned long long)m->minor_faults,                    \
+                (unsigned long long)m->major_faults);                   \
+        }                                                               \
+        if (GREATESTPP_TRACKING_ALLOCS) {                               \
+            const greatestpp_alloc_stats *a = &info->allocs;            \
+            fprintf(GREATESTPP_STDOUT,                                  \
+                " [%llu allocs, %llu bytes, peak %lld]",                \
+                (unsigned long long)a->allocs,                          \
+                (unsigned long long)a->bytes, (long long)a->peak);      \
+            if (a->live > 0) {                                          \
+                fprintf(GREATESTPP_STDOUT, " LEAKED %lld bytes",        \
+                    (long long)a->live);                                \
+            }                                                           \
+        }                                                               \
+        fprintf(GREATESTPP_STDOUT, "\n");                               \
+    } else if (greatestpp_info.col % greatestpp_info.width == 0) {      \
+        fprintf(GREATESTPP_STDOUT, "\n");                               \
+        greatestpp_info.col = 0;                                        \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_console_suite_end(const char *suite_name) {      \
+    (void)suite_name;                                                   \
+    if (greatestpp_info.suite.tests_run > 0) {                          \
+        fprintf(GREATESTPP_STDOUT,                                      \
+            "\n%u tests - %u pass, %u fail, %u skipped",                \
+            greatestpp_info.suite.tests_run,                            \
+            greatestpp_info.suite.passed,                               \
+            greatestpp_info.suite.failed,                               \
+            greatestpp_info.suite.skipped);                             \
+        GREATESTPP_CLOCK_DIFF(greatestpp_info.suite.pre_suite,          \
+            greatestpp_info.suite.post_suite);                          \
+        fprintf(GREATESTPP_STDOUT, "\n");                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_console_run_end(void) {                          \
+    fprintf(GREATESTPP_STDOUT,                                          \
+        "\nTotal: %u tests", greatestpp_info.tests_run);                \
+    GREATESTPP_CLOCK_DIFF(greatestpp_info.begin, greatestpp_info.end);  \
+    fprintf(GREATESTPP_STDOUT, "\n");                                   \
+    fprintf(GREATESTPP_STDOUT,                                          \
+        "Pass: %u, fail: %u, skip: %u.\n",                              \
+        greatestpp_info.passed,                                         \
+        greatestpp_info.failed, greatestpp_info.skipped);               \
+}                                                                       \
+                                                                        \
+/* Write S as the body of a JSON string. */                             \
+static void greatestpp_json_escape(FILE *f, const char *s) {            \
+    for (; s && *s; s++) {                                              \
+        unsigned char c = (unsigned char)*s;                            \
+        if (c == '"' || c == '\\') {                                    \
+            fprintf(f, "\\%c", c);                                      \
+        } else if (c == '\n') {                                         \
+            fputs("\\n", f);                                            \
+        } else if (c < 0x20) {                                          \
+            fprintf(f, "\\u%04x", c);                                   \
+        } else {                                                        \
+            fputc(c, f);                                                \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Write S with XML's special characters escaped. Whitespace is kept    \
+ * as character references, so it survives in attributes; other         \
+ * control characters can't appear in XML, so they become '?'. */       \
+static void greatestpp_xml_escape(std::string &out, const char *s) {    \
+    for (; s && *s; s++) {                                              \
+        switch (*s) {                                                   \
+        case '<': out += "&lt;"; break;                                 \
+        case '>': out += "&gt;"; break;                                 \
+        case '&': out += "&amp;"; break;                                \
+        case '"': out += "&quot;"; break;                               \
+        case '\t': out += "&#9;"; break;                                \
+        case '\n': out += "&#10;"; break;                               \
+        case '\r': out += "&#13;"; break;                               \
+        default: out += (unsigned char)*s < 0x20 ? '?' : *s; break;     \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static const char *greatestpp_result_name(int res) {                    \
+    return res < 0 ? "fail" : res > 0 ? "skip" : "pass";                \
+}                                                                       \
+                                                                        \
+/* TAP reporter. The plan comes last, once the count is known. */       \
+static void greatestpp_tap_run_begin(void) {                            \
+    fprintf(greatestpp_info.out, "TAP version 13\n");                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_tap_suite_begin(const char *suite_name) {        \
+    fprintf(greatestpp_info.out, "# Suite %s\n", suite_name);           \
+}                                                                       \
+                                                                        \
+static void greatestpp_tap_test_end(const char *name, int res,          \
+        const greatestpp_test_info *info,                               \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    FILE *f = greatestpp_info.out;                                      \
+    (void)pre;                                                          \
+    (void)post;                                                         \
+    greatestpp_info.reported++;                                         \
+    fprintf(f, "%s %u - %s/%s", res < 0 ? "not ok" : "ok",              \
+        greatestpp_info.reported, greatestpp_info.suite.name, name);    \
+    if (res > 0) fprintf(f, " # SKIP %s", info->msg ? info->msg : "");  \
+    fprintf(f, "\n");                                                   \
+    if (res < 0) {                                                      \
+        fprintf(f, "  ---\n  message: \"");                             \
+        greatestpp_json_escape(f, info->msg);                           \
+        fprintf(f, "\"\n");                                             \
+        if (info->fail_file) {                                          \
+            fprintf(f, "  at: \"%s:%u\"\n", info->fail_file,            \
+                info->fail_line);                                       \
+        }                                                               \
+        fprintf(f, "  ...\n");                                          \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_tap_suite_end(const char *suite_name) {          \
+    (void)suite_name;                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_tap_run_end(void) {                              \
+    fprintf(greatestpp_info.out, "1..%u\n", greatestpp_info.reported);  \
+}                                                                       \
+                                                                        \
+/* JUnit XML reporter. A suite's test cases are kept until the suite    \
+ * ends, since the <testsuite> element needs its counts first. */       \
+static std::string greatestpp_junit_cases;                              \
+                                                                        \
+static void greatestpp_junit_run_begin(void) {                          \
+    fprintf(greatestpp_info.out,                                        \
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n");  \
+}                                                                       \
+                                                                        \
+static void greatestpp_junit_suite_begin(const char *suite_name) {      \
+    (void)suite_name;                                                   \
+    greatestpp_junit_cases.clear();                                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_junit_test_end(const char *name, int res,        \
+        const greatestpp_test_info *info,                               \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    std::string &out = greatestpp_junit_cases;                          \
+    char buf[64];                                                       \
+    out += "    <testcase classname=\"";                                \
+    greatestpp_xml_escape(out, greatestpp_info.suite.name);             \
+    out += "\" name=\"";                                                \
+    greatestpp_xml_escape(out, name);                                   \
+    snprintf(buf, sizeof(buf), "\" time=\"%.6f\"",                      \
+        (double)(post.wall_ns - pre.wall_ns) / 1e9);                    \
+    out += buf;                                                         \
+    if (res == 0) {                                                     \
+        out += "/>\n";                                                  \
+        return;                                                         \
+    }                                                                   \
+    out += res < 0 ? ">\n      <failure message=\"" : ">\n      <skipped message=\""; \
+    greatestpp_xml_escape(out, info->msg);                              \
+    out += "\"";                                                        \
+    if (res < 0) {                                                      \
+        out += ">";                                                     \
+        if (info->fail_file) {                                          \
+            snprintf(buf, sizeof(buf), ":%u", info->fail_line);         \
+            greatestpp_xml_escape(out, info->fail_file);                \
+            out += buf;                                                 \
+        }                                                               \
+        out += "</failure>\n";                                          \
+    } else {                                                            \
+        out += "/>\n";                                                  \
+    }                                                                   \
+    out += "    </testcase>\n";                                         \
+}                                                                       \
                                                                         \
-void greatestpp_post_test(const char *name, int res) {                    \
-    GREATESTPP_SET_TIME(greatestpp_info.suite.post_test);                   \
-    if (greatestpp_info.teardown) {                                       \
-        void *udata = greatestpp_info.teardown_udata;                     \
-        greatestpp_info.teardown(udata);                                  \
+static void greatestpp_junit_suite_end(const char *suite_name) {        \
+    std::string name;                                                   \
+    greatestpp_suite_info *suite = &greatestpp_info.suite;              \
+    if (suite->tests_run == 0) return;                                  \
+    greatestpp_xml_escape(name, suite_name);                            \
+    fprintf(greatestpp_info.out,                                        \
+        "  <testsuite name=\"%s\" tests=\"%u\" failures=\"%u\" "        \
+        "skipped=\"%u\" time=\"%.6f\">\n%s  </testsuite>\n",            \
+        name.c_str(), suite->tests_run, suite->failed, suite->skipped,  \
+        (double)(suite->post_suite.wall_ns - suite->pre_suite.wall_ns) / 1e9, \
+        greatestpp_junit_cases.c_str());                                \
+    greatestpp_junit_cases.clear();                                     \
+}                                                                       \
+                                                                        \
+static void greatestpp_junit_run_end(void) {                            \
+    fprintf(greatestpp_info.out, "</testsuites>\n");                    \
+}                                                                       \
+                                                                        \
+/* JSON Lines reporter: one object per test, suite and run. */          \
+static void greatestpp_jsonl_run_begin(void) {}                         \
+                                                                        \
+static void greatestpp_jsonl_suite_begin(const char *suite_name) {      \
+    (void)suite_name;                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_jsonl_test_end(const char *name, int res,        \
+        const greatestpp_test_info *info,                               \
+        greatestpp_time pre, greatestpp_time post) {                    \
+    FILE *f = greatestpp_info.out;                                      \
+    fprintf(f, "{\"type\":\"test\",\"suite\":\"");                      \
+    greatestpp_json_escape(f, greatestpp_info.suite.name);              \
+    fprintf(f, "\",\"name\":\"");                                       \
+    greatestpp_json_escape(f, name);                                    \
+    fprintf(f, "\",\"result\":\"%s\"", greatestpp_result_name(res));    \
+    if (info->msg) {                                                    \
+        fprintf(f, ",\"msg\":\"");                                      \
+        greatestpp_json_escape(f, info->msg);                           \
+        fprintf(f, "\"");                                               \
+    }                                                                   \
+    if (res < 0 && info->fail_file) {                                   \
+        fprintf(f, ",\"file\":\"");                                     \
+        greatestpp_json_escape(f, info->fail_file);                     \
+        fprintf(f, "\",\"line\":%u", info->fail_line);                  \
+    }                                                                   \
+    if (greatestpp_info.flags & GREATESTPP_FLAG_PERF) {                 \
+        fprintf(f, ",\"cycles\":%llu,\"instructions\":%llu,"            \
+            "\"branch_misses\":%llu,\"cache_misses\":%llu",             \
+            (unsigned long long)info->perf.cycles,                      \
+            (unsigned long long)info->perf.instructions,                \
+            (unsigned long long)info->perf.branch_misses,               \
+            (unsigned long long)info->perf.cache_misses);               \
     }                                                                   \
+    if (info->mem.sampled                                               \
+        && (greatestpp_info.flags & GREATESTPP_FLAG_MEMORY)) {          \
+        fprintf(f, ",\"rss_start_kb\":%llu,\"rss_end_kb\":%llu,"        \
+            "\"rss_peak_kb\":%llu,\"minor_faults\":%llu,"               \
+            "\"major_faults\":%llu",                                    \
+            (unsigned long long)info->mem.start_kb,                     \
+            (unsigned long long)info->mem.end_kb,                       \
+            (unsigned long long)info->mem.peak_kb,                      \
+            (unsigned long long)info->mem.minor_faults,                 \
+            (unsigned long long)info->mem.major_faults);                \
+    }                                                                   \
+    if (GREATESTPP_TRACKING_ALLOCS) {                                   \
+        fprintf(f, ",\"allocs\":%llu,\"alloc_bytes\":%llu,"             \
+            "\"peak_bytes\":%lld,\"leaked_bytes\":%lld",                \
+            (unsigned long long)info->allocs.allocs,                    \
+            (unsigned long long)info->allocs.bytes,                     \
+            (long long)info->allocs.peak,                               \
+            (long long)(info->allocs.live > 0 ? info->allocs.live : 0)); \
+    }                                                                   \
+    fprintf(f, ",\"wall_ns\":%llu,\"cpu_ns\":%llu}\n",                  \
+        (unsigned long long)(post.wall_ns - pre.wall_ns),               \
+        (unsigned long long)(post.cpu_ns - pre.cpu_ns));                \
+}                                                                       \
                                                                         \
-    if (res < 0) {                                                      \
-        greatestpp_do_fail(name);                                         \
-    } else if (res > 0) {                                               \
-        greatestpp_do_skip(name);                                         \
-    } else if (res == 0) {                                              \
-        greatestpp_do_pass(name);                                         \
+static void greatestpp_jsonl_suite_end(const char *suite_name) {        \
+    greatestpp_suite_info *suite = &greatestpp_info.suite;              \
+    if (suite->tests_run == 0) return;                                  \
+    fprintf(greatestpp_info.out, "{\"type\":\"suite\",\"name\":\"");    \
+    greatestpp_json_escape(greatestpp_info.out, suite_name);            \
+    fprintf(greatestpp_info.out, "\",\"tests\":%u,\"passed\":%u,"       \
+        "\"failed\":%u,\"skipped\":%u,\"wall_ns\":%llu}\n",             \
+        suite->tests_run, suite->passed, suite->failed, suite->skipped, \
+        (unsigned long long)(suite->post_suite.wall_ns                  \
+            - suite->pre_suite.wall_ns));                               \
+}                                                                       \
+                                                                        \
+static void greatestpp_jsonl_run_end(void) {                            \
+    fprintf(greatestpp_info.out, "{\"type\":\"run\",\"tests\":%u,"      \
+        "\"passed\":%u,\"failed\":%u,\"skipped\":%u,\"wall_ns\":%llu}\n", \
+        greatestpp_info.tests_run, greatestpp_info.passed,              \
+        greatestpp_info.failed, greatestpp_info.skipped,                \
+        (unsigned long long)(greatestpp_info.end.wall_ns                \
+            - greatestpp_info.begin.wall_ns));                          \
+}                                                                       \
+                                                                        \
+static const greatestpp_reporter greatestpp_reporters[] = {             \
+    { "console", greatestpp_console_run_begin,                          \
+      greatestpp_console_suite_begin, greatestpp_console_test_end,      \
+      greatestpp_console_suite_end, greatestpp_console_run_end },       \
+    { "tap", greatestpp_tap_run_begin, greatestpp_tap_suite_begin,      \
+      greatestpp_tap_test_end, greatestpp_tap_suite_end,                \
+      greatestpp_tap_run_end },                                         \
+    { "junit", greatestpp_junit_run_begin, greatestpp_junit_suite_begin, \
+      greatestpp_junit_test_end, greatestpp_junit_suite_end,            \
+      greatestpp_junit_run_end },                                       \
+    { "jsonl", greatestpp_jsonl_run_begin, greatestpp_jsonl_suite_begin, \
+      greatestpp_jsonl_test_end, greatestpp_jsonl_suite_end,            \
+      greatestpp_jsonl_run_end },                                       \
+};                                                                      \
+                                                                        \
+/* Where to print anything besides the report, such as benchmark stats  \
+ * or --slowest: stderr when a tap, junit or jsonl report is going to   \
+ * stdout, so as not to corrupt it. */                                  \
+FILE *greatestpp_notes(void) {                                          \
+    if (greatestpp_info.reporter != NULL                                \
+        && greatestpp_info.reporter != &greatestpp_reporters[0]         \
+        && greatestpp_info.out_path == NULL) {                          \
+        return stderr;                                                  \
     }                                                                   \
-    greatestpp_info.suite.tests_run++;                                    \
-    greatestpp_info.col++;                                                \
-    if (GREATESTPP_IS_VERBOSE()) {                                        \
-        GREATESTPP_CLOCK_DIFF(greatestpp_info.suite.pre_test,               \
-            greatestpp_info.suite.post_test);                             \
-        fprintf(GREATESTPP_STDOUT, "\n");                                 \
-    } else if (greatestpp_info.col % greatestpp_info.width == 0) {          \
-        fprintf(GREATESTPP_STDOUT, "\n");                                 \
-        greatestpp_info.col = 0;                                          \
+    return GREATESTPP_STDOUT;                                           \
+}                                                                       \
+                                                                        \
+/* Open the --output file, if any, and start the report. */             \
+void greatestpp_open_report(void) {                                     \
+    const char *path = greatestpp_info.out_path;                        \
+    if (greatestpp_info.reporter == NULL) {                             \
+        greatestpp_info.reporter = &greatestpp_reporters[0];            \
+    }                                                                   \
+    greatestpp_info.out = GREATESTPP_STDOUT;                            \
+    if (path != NULL) {                                                 \
+        greatestpp_info.out = fopen(path, "w");                         \
+        if (greatestpp_info.out == NULL) {                              \
+            fprintf(greatestpp_notes(), "Could not open %s\n", path);   \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+        setvbuf(greatestpp_info.out, NULL, _IOFBF, GREATESTPP_OUTPUT_BUFFER); \
     }                                                                   \
-    if (GREATESTPP_STDOUT == stdout) fflush(stdout);                      \
+    if (!GREATESTPP_LIST_ONLY()) greatestpp_info.reporter->run_begin(); \
 }                                                                       \
                                                                         \
-static void greatest_run_suite(greatestpp_suite_cb *suite_cb,             \
-                               const char *suite_name) {                \
-    if (greatestpp_info.suite_filter &&                                   \
-        !greatestpp_name_match(suite_name, greatestpp_info.suite_filter))   \
-        return;                                                         \
-    if (GREATESTPP_FIRST_FAIL() && greatest_info.failed > 0) return;      \
-    greatestpp_info.suite.tests_run = 0;                                  \
-    greatestpp_info.suite.failed = 0;                                     \
-    greatestpp_info.suite.passed = 0;                                     \
-    greatestpp_info.suite.skipped = 0;                                    \
-    greatestpp_info.suite.pre_suite = 0;                                  \
-    greatestpp_info.suite.post_suite = 0;                                 \
-    greatestpp_info.suite.pre_test = 0;                                   \
-    greatestpp_info.suite.post_test = 0;                                  \
-    greatestpp_info.col = 0;                                              \
-    fprintf(GREATESTPP_STDOUT, "\n* Suite %s:\n", suite_name);            \
-    GREATESTPP_SET_TIME(greatestpp_info.suite.pre_suite);                   \
-    suite_cb();                                                         \
-    GREATESTPP_SET_TIME(greatestpp_info.suite.post_suite);                  \
-    if (greatestpp_info.suite.tests_run > 0) {                            \
-        fprintf(GREATESTPP_STDOUT,                                        \
-            "\n%u tests - %u pass, %u fail, %u skipped",                \
-            greatestpp_info.suite.tests_run,                              \
-            greatestpp_info.suite.passed,                                 \
-            greatestpp_info.suite.failed,                                 \
-            greatestpp_info.suite.skipped);                               \
-        GREATESTPP_CLOCK_DIFF(greatestpp_info.suite.pre_suite,              \
-            greatestpp_info.suite.post_suite);                            \
-        fprintf(GREATESTPP_STDOUT, "\n");                                 \
+void greatestpp_close_report(void) {                                    \
+    fflush(GREATESTPP_STDOUT);                                          \
+    if (greatestpp_info.out != GREATESTPP_STDOUT) {                     \
+        fclose(greatestpp_info.out);                                    \
+        greatestpp_info.out = GREATESTPP_STDOUT;                        \
     }                                                                   \
-    greatestpp_info.setup = NULL;                                         \
-    greatestpp_info.setup_udata = NULL;                                   \
-    greatestpp_info.teardown = NULL;                                      \
-    greatestpp_info.teardown_udata = NULL;                                \
-    greatestpp_info.passed += greatestpp_info.suite.passed;                 \
-    greatestpp_info.failed += greatestpp_info.suite.failed;                 \
-    greatestpp_info.skipped += greatestpp_info.suite.skipped;               \
-    greatestpp_info.tests_run += greatestpp_info.suite.tests_run;           \
 }                                                                       \
                                                                         \
-void greatestpp_do_pass(const char *name) {                               \
+/* Start a suite when replaying a journal. */                           \
+static void greatestpp_replay_suite(const char *name,                   \
+                                    greatestpp_time pre) {              \
+    memset(&greatestpp_info.suite, 0, sizeof(greatestpp_info.suite));   \
+    greatestpp_info.suite.name = name;                                  \
+    greatestpp_info.suite.pre_suite = pre;                              \
+    greatestpp_info.col = 0;                                            \
+    greatestpp_info.reporter->suite_begin(name);                        \
+}                                                                       \
+                                                                        \
+/* With --journal-report, report the results in a journal, perhaps cut  \
+ * short by a crash, with the chosen reporter instead of running any    \
+ * tests, then exit. A journal without an end record fails the run. */  \
+void greatestpp_replay_journal(void) {                                  \
+    const char *path = greatestpp_info.journal_report_file;             \
+    std::vector<greatestpp_journal_record> records;                     \
+    greatestpp_journal_header h;                                        \
+    greatestpp_journal_record r;                                        \
+    greatestpp_time pre;                                                \
+    greatestpp_time post;                                               \
+    greatestpp_time last;                                               \
+    bool in_suite = false;                                              \
+    bool ended = false;                                                 \
+    size_t i;                                                           \
+    FILE *f;                                                            \
+    if (path == NULL) return;                                           \
+    f = fopen(path, "rb");                                              \
+    if (f == NULL) {                                                    \
+        fprintf(greatestpp_notes(), "Could not open %s\n", path);       \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    if (fread(&h, sizeof(h), 1, f) != 1                                 \
+        || memcmp(h.magic, GREATESTPP_JOURNAL_MAGIC, sizeof(h.magic)) != 0 \
+        || h.record_size != sizeof(r)) {                                \
+        fprintf(greatestpp_notes(), "%s is not a journal\n", path);     \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    while (fread(&r, sizeof(r), 1, f) == 1                              \
+        && r.kind != GREATESTPP_JOURNAL_EMPTY) {                        \
+        r.suite[sizeof(r.suite) - 1] = '\0';                            \
+        r.name[sizeof(r.name) - 1] = '\0';                              \
+        r.file[sizeof(r.file) - 1] = '\0';                              \
+        r.msg[sizeof(r.msg) - 1] = '\0';                                \
+        records.push_back(r);                                           \
+    }                                                                   \
+    fclose(f);                                                          \
+    memset(&last, 0, sizeof(last));                                     \
+    if (!records.empty()) last.wall_ns = records[0].start_ns;           \
+    greatestpp_info.begin = last;                                       \
+    for (i = 0; i < records.size(); i++) {                              \
+        const greatestpp_journal_record *rec = &records[i];             \
+        pre.wall_ns = rec->start_ns;                                    \
+        pre.cpu_ns = 0;                                                 \
+        post.wall_ns = rec->start_ns + rec->wall_ns;                    \
+        post.cpu_ns = rec->cpu_ns;                                      \
+        if (rec->kind == GREATESTPP_JOURNAL_END) {                      \
+            greatestpp_info.begin = pre;                                \
+            greatestpp_info.end = post;                                 \
+            ended = true;                                               \
+            continue;                                                   \
+        }                                                               \
+        if (in_suite                                                    \
+            && strcmp(greatestpp_info.suite.name, rec->suite) != 0) {   \
+            greatestpp_info.suite.post_suite = last;                    \
+            greatestpp_report_suite();                                  \
+            in_suite = false;                                           \
+        }                                                               \
+        if (!in_suite) {                                                \
+            greatestpp_replay_suite(rec->suite, pre);                   \
+            in_suite = true;                                            \
+        }                                                               \
+        if (rec->kind == GREATESTPP_JOURNAL_SUITE) {                    \
+            greatestpp_info.suite.pre_suite = pre;                      \
+            greatestpp_info.suite.post_suite = post;                    \
+            greatestpp_report_suite();                                  \
+            in_suite = false;                                           \
+        } else {                                                        \
+            greatestpp_test_info info;                                  \
+            memset(&info, 0, sizeof(info));                             \
+            info.msg = rec->msg[0] ? rec->msg : NULL;                   \
+            info.fail_file = rec->file[0] ? rec->file : NULL;           \
+            info.fail_line = rec->fail_line;                            \
+            greatestpp_record_test(rec->name, rec->res, &info, pre, post); \
+        }                                                               \
+        last = post;                                                    \
+    }                                                                   \
+    if (in_suite) {                                                     \
+        greatestpp_info.suite.post_suite = last;                        \
+        greatestpp_report_suite();                                      \
+    }                                                                   \
+    if (!ended) greatestpp_info.end = last;                             \
+    greatestpp_info.reporter->run_end();                                \
+    greatestpp_report_timings();                                        \
+    if (!ended) {                                                       \
+        fprintf(greatestpp_notes(),                                     \
+            "The journal ends early: the run was cut short.\n");        \
+    }                                                                   \
+    greatestpp_close_report();                                          \
+    exit(greatestpp_info.failed > 0 || !ended                           \
+        ? EXIT_FAILURE : EXIT_SUCCESS);                                 \
+}                                                                       \
+                                                                        \
+/* Start the --journal, if any. */                                      \
+void greatestpp_open_journal(void) {                                    \
+    const char *path = greatestpp_info.journal_file;                    \
+    greatestpp_journal_header h;                                        \
+    if (path == NULL || GREATESTPP_LIST_ONLY()) return;                 \
+    memset(&h, 0, sizeof(h));                                           \
+    memcpy(h.magic, GREATESTPP_JOURNAL_MAGIC, sizeof(h.magic));         \
+    h.record_size = sizeof(greatestpp_journal_record);                  \
+    if (!greatestpp_journal_start(path, &h)) {                          \
+        fprintf(greatestpp_notes(), "Could not open %s\n", path);       \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    greatestpp_journal_out.active = true;                               \
+}                                                                       \
+                                                                        \
+/* Mark the --journal as complete and close it. */                      \
+void greatestpp_close_journal(void) {                                   \
+    if (!greatestpp_journal_out.active) return;                         \
+    greatestpp_journal_write(GREATESTPP_JOURNAL_END, NULL, 0, NULL,     \
+        greatestpp_info.begin, greatestpp_info.end);                    \
+    greatestpp_journal_finish();                                        \
+    greatestpp_journal_out.active = false;                              \
+}                                                                       \
+                                                                        \
+void greatestpp_do_pass(const char *name,                               \
+                        const greatestpp_test_info *info) {             \
     if (GREATESTPP_IS_VERBOSE()) {                                        \
         fprintf(GREATESTPP_STDOUT, "PASS %s: %s",                         \
-            name, greatestpp_info.msg ? greatestpp_info.msg : "");          \
+            name, info->msg ? info->msg : "");                          \
     } else {                                                            \
         fprintf(GREATESTPP_STDOUT, ".");                                  \
     }                                                                   \
-    greatestpp_info.suite.passed++;                                       \
 }                                                                       \
                                                                         \
-void greatestpp_do_fail(const char *name) {                               \
-    if (GREATESTPP_IS_VERBOSE()) {                                        \
-        fprintf(GREATESTPP_STDOUT,                                        \
-            "FAIL %s: %s (%s:%u)",                                      \
-            name, greatestpp_info.msg ? greatestpp_info.msg : "",           \
-            greatestpp_info.fail_file, greatestpp_info.fail_line);          \
-    } else {                                                            \
+void greatestpp_do_fail(const char *name,                               \
+                        const greatestpp_test_info *info) {             \
+    if (!GREATESTPP_IS_VERBOSE()) {                                       \
         fprintf(GREATESTPP_STDOUT, "F");                                  \
         /* add linebreak if in line of '.'s */                          \
         if (greatestpp_info.col % greatestpp_info.width != 0)               \
             fprintf(GREATESTPP_STDOUT, "\n");                             \
         greatestpp_info.col = 0;                                          \
-        fprintf(GREATESTPP_STDOUT, "FAIL %s: %s (%s:%u)\n",               \
-            name,                                                       \
-            greatestpp_info.msg ? greatestpp_info.msg : "",                 \
-            greatestpp_info.fail_file, greatestpp_info.fail_line);          \
     }                                                                   \
-    greatestpp_info.suite.failed++;                                       \
+    fprintf(GREATESTPP_STDOUT, "FAIL %s: %s",                             \
+        name, info->msg ? info->msg : "");                              \
+    /* A timeout or crash has no location. */                           \
+    if (info->fail_file) {                                              \
+        fprintf(GREATESTPP_STDOUT, " (%s:%u)",                          \
+            info->fail_file, info->fail_line);                          \
+    }                                                                   \
+    if (!GREATESTPP_IS_VERBOSE()) fprintf(GREATESTPP_STDOUT, "\n");     \
 }                                                                       \
                                                                         \
-void greatestpp_do_skip(const char *name) {                               \
+void greatestpp_do_skip(const char *name,                               \
+                        const greatestpp_test_info *info) {             \
     if (GREATESTPP_IS_VERBOSE()) {                                        \
         fprintf(GREATESTPP_STDOUT, "SKIP %s: %s",                         \
             name,                                                       \
-            greatestpp_info.msg ?                                         \
-            greatestpp_info.msg : "" );                                   \
+            info->msg ? info->msg : "" );                               \
     } else {                                                            \
         fprintf(GREATESTPP_STDOUT, "s");                                  \
     }                                                                   \
-    greatestpp_info.suite.skipped++;                                      \
 }                                                                       \
                                                                         \
 void greatestpp_usage(const char *name) {                                 \
     fprintf(GREATESTPP_STDOUT,                                            \
-        "Usage: %s [-hlfv] [-s SUITE] [-t TEST]\n"                      \
+        "Usage: %s [-hlfv] [-s SUITE] [-t TEST] [-x TEST] [-X SUITE]\n" \
+        "          [--filter-file FILE] [-j N] [-p N] [--fork-batch N]\n" \
+        "          [--slowest N] [--timings FILE]\n"                    \
+        "          [--bench] [--bench-time MS] [--bench-samples N]\n"   \
+        "          [--bench-save FILE] [--bench-compare FILE]\n"        \
+        "          [--bench-threshold PCT] [--tag TAG]\n"                  \
+        "          [--reporter NAME] [--output FILE] [--perf]\n"       \
+        "          [--timeout MS] [--cache FILE] [--no-cache]\n"        \
+        "          [--failed-first] [--rerun-failed] [--order=duration]\n" \
+        "          [--shard I/N] [--shard-timings FILE]\n"              \
+        "          [--journal FILE] [--journal-report FILE] [--async N]\n" \
+        "          [--profile DIR] [--profile-threshold MS]\n"         \
+        "          [--stress-time MS] [--stress-pin] [--memory-report N]\n" \
         "  -h        print this Help\n"                                 \
         "  -l        List suites and their tests, then exit\n"          \
         "  -f        Stop runner after first failure\n"                 \
         "  -v        Verbose output\n"                                  \
-        "  -s SUITE  only run suite named SUITE\n"                      \
-        "  -t TEST   only run test named TEST\n",                       \
+        "  -s SUITE  only run suites matching SUITE (repeatable)\n"     \
+        "  -t TEST   only run tests matching TEST (repeatable)\n"       \
+        "  -x TEST   skip tests matching TEST (repeatable)\n"           \
+        "  -X SUITE  skip suites matching SUITE (repeatable)\n"         \
+        "  --filter-file FILE  add -t patterns from FILE, or -x if '!'\n" \
+        "            patterns match substrings, globs with *?[ or\n"    \
+        "            exact names with a leading =\n"                    \
+        "  --tag TAG  only run registered tests tagged TAG\n"                \
+        "  --reporter NAME  report as console (default), tap, junit or jsonl\n" \
+        "  --output FILE    write the tap/junit/jsonl report to FILE\n" \
+        "  -j N      run tests on N worker threads (0: one per CPU)\n"       \
+        "  -p N      run tests in N worker processes (0: one per CPU)\n" \
+        "  --fork-batch N  with -p, fork a fresh worker after every N\n" \
+        "                  tests (1: each test in its own process)\n"   \
+        "  --async N run up to N async tests of a suite at once\n"      \
+        "  --stress-time MS  run each STRESS_TEST for MS ms\n"            \
+        "  --stress-pin    pin each STRESS_TEST thread to its own CPU\n" \
+        "  --timeout MS    fail a test still running after MS ms; with -p\n" \
+        "                  its worker is killed and the run goes on,\n" \
+        "                  otherwise the run stops there\n"             \
+        "  --cache FILE    keep each test's last result and time in FILE\n" \
+        "                  (default " GREATESTPP_DEFAULT_CACHE_FILE ")\n" \
+        "  --no-cache      don't read or write the cache\n"             \
+        "  --failed-first  run tests that failed last time first\n"     \
+        "  --rerun-failed  only run tests that failed last time\n"      \
+        "  --order=duration  run the slowest tests first\n"             \
+        "  --shard I/N     only run shard I (from 0) of N, split by name\n" \
+        "  --shard-timings FILE  balance the shards by the times in a\n" \
+        "                  --timings or --cache file\n"                 \
+        "  --journal FILE  record each result in FILE as it comes in\n" \
+        "  --journal-report FILE  report the results in a journal,\n"   \
+        "                  even one cut short by a crash, instead of\n" \
+        "                  running the tests\n"                         \
+        "  --slowest N     print the N slowest tests\n"                 \
+        "  --timings FILE  write each test's wall and CPU time to FILE\n" \
+        "  --bench         run the benchmarks instead of the tests\n"   \
+        "  --bench-time MS target time per benchmark sample\n"          \
+        "  --bench-samples N  timed samples per benchmark\n"            \
+        "  --bench-save FILE     save benchmark samples as a baseline\n" \
+        "  --bench-compare FILE  compare benchmarks against a baseline\n" \
+        "  --bench-threshold PCT slowdown that counts as a regression\n" \
+        "  --perf          count cycles, instructions, branch and cache\n" \
+        "                  misses per test and benchmark (Linux)\n"     \
+        "  --memory-report N  measure each test's RSS and page faults,\n" \
+        "                  and print the N whose RSS grew the most (Linux)\n" \
+        "  --profile DIR   sample each test's stacks on CPU time, and\n" \
+        "                  write them to DIR/SUITE.TEST.folded\n"       \
+        "  --profile-threshold MS  only keep the profiles of tests that\n" \
+        "                  took at least MS ms\n",                      \
         name);                                                          \
 }                                                                       \
                                                                         \
+static bool greatestpp_slower(const greatestpp_timing &a,               \
+                              const greatestpp_timing &b) {             \
+    return a.wall_ns > b.wall_ns;                                       \
+}                                                                       \
+                                                                        \
+/* How far a test's peak RSS rose over its starting RSS. With -j, the   \
+ * peak can be reset by a test starting alongside, below the start. */  \
+static uint64_t greatestpp_rss_growth(const greatestpp_memory *m) {     \
+    return m->peak_kb > m->start_kb ? m->peak_kb - m->start_kb : 0;     \
+}                                                                       \
+                                                                        \
+static bool greatestpp_rss_grew_more(const greatestpp_timing &a,        \
+                                     const greatestpp_timing &b) {      \
+    return greatestpp_rss_growth(&a.mem) > greatestpp_rss_growth(&b.mem); \
+}                                                                       \
+                                                                        \
+/* Print the --slowest tests and the --memory-report, and write the     \
+ * --timings file as tab-separated "suite, test, result, wall ns, cpu   \
+ * ns" lines, followed by the hardware counters with --perf and the     \
+ * RSS in kB and page faults with --memory-report. */                   \
+void greatestpp_report_timings(void) {                                  \
+    int perf = greatestpp_info.flags & GREATESTPP_FLAG_PERF;            \
+    int mem = greatestpp_info.flags & GREATESTPP_FLAG_MEMORY;           \
+    size_t i;                                                           \
+    if (greatestpp_info.slowest > 0 && !greatestpp_timings.empty()) {   \
+        std::vector<greatestpp_timing> sorted(greatestpp_timings);      \
+        size_t count = greatestpp_info.slowest < sorted.size()          \
+            ? greatestpp_info.slowest : sorted.size();                  \
+        std::stable_sort(sorted.begin(), sorted.end(), greatestpp_slower); \
+        fprintf(greatestpp_notes(), "\nSlowest %u tests:\n",            \
+            (unsigned int)count);                                       \
+        for (i = 0; i < count; i++) {                                   \
+            fprintf(greatestpp_notes(), "  %10.3f ms  %10.3f ms cpu  %s/%s\n", \
+                (double)sorted[i].wall_ns / 1e6,                        \
+                (double)sorted[i].cpu_ns / 1e6,                         \
+                sorted[i].suite, sorted[i].name);                       \
+        }                                                               \
+    }                                                                   \
+    if (greatestpp_info.memory_report > 0) {                            \
+        std::vector<greatestpp_timing> sorted;                          \
+        size_t count;                                                   \
+        for (i = 0; i < greatestpp_timings.size(); i++) {               \
+            if (greatestpp_timings[i].mem.sampled) {                    \
+                sorted.push_back(greatestpp_timings[i]);                \
+            }                                                           \
+        }                                                               \
+        count = greatestpp_info.memory_report < sorted.size()           \
+            ? greatestpp_info.memory_report : sorted.size();            \
+        std::stable_sort(sorted.begin(), sorted.end(),                  \
+            greatestpp_rss_grew_more);                                  \
+        fprintf(greatestpp_notes(), "\nLargest RSS growth, of %u tests:\n" \
+            "  %10s %10s %10s %10s %8s\n", (unsigned int)sorted.size(), \
+            "peak kB", "growth kB", "kept kB", "minor", "major");       \
+        for (i = 0; i < count; i++) {                                   \
+            const greatestpp_memory *m = &sorted[i].mem;                \
+            fprintf(greatestpp_notes(), "  %10llu %10llu %+10lld %10llu %8llu  %s/%s\n", \
+                (unsigned long long)m->peak_kb,                         \
+                (unsigned long long)greatestpp_rss_growth(m),           \
+                (long long)(m->end_kb - m->start_kb),                   \
+                (unsigned long long)m->minor_faults,                    \
+                (unsigned long long)m->major_faults,                    \
+                sorted[i].suite, sorted[i].name);                       \
+        }                                                               \
+    }                                                                   \
+    if (greatestpp_info.timings_file) {                                 \
+        FILE *f = fopen(greatestpp_info.timings_file, "w");             \
+        if (f == NULL) {                                                \
+            fprintf(greatestpp_notes(), "Could not write timings to %s\n", \
+                greatestpp_info.timings_file);                          \
+            return;                                                     \
+        }                                                               \
+        fprintf(f, "# suite\ttest\tresult\twall_ns\tcpu_ns%s%s\n", perf \
+            ? "\tcycles\tinstructions\tbranch_misses\tcache_misses" : "", \
+            mem ? "\trss_start_kb\trss_end_kb\trss_peak_kb"             \
+                "\tminor_faults\tmajor_faults" : "");                   \
+        for (i = 0; i < greatestpp_timings.size(); i++) {               \
+            const greatestpp_timing *t = &greatestpp_timings[i];        \
+            fprintf(f, "%s\t%s\t%s\t%llu\t%llu", t->suite, t->name,     \
+                t->res < 0 ? "fail" : t->res > 0 ? "skip" : "pass",     \
+                (unsigned long long)t->wall_ns,                         \
+                (unsigned long long)t->cpu_ns);                         \
+            if (perf) {                                                 \
+                fprintf(f, "\t%llu\t%llu\t%llu\t%llu",                  \
+                    (unsigned long long)t->perf.cycles,                 \
+                    (unsigned long long)t->perf.instructions,           \
+                    (unsigned long long)t->perf.branch_misses,          \
+                    (unsigned long long)t->perf.cache_misses);          \
+            }                                                           \
+            if (mem) {                                                  \
+                fprintf(f, "\t%llu\t%llu\t%llu\t%llu\t%llu",            \
+                    (unsigned long long)t->mem.start_kb,                \
+                    (unsigned long long)t->mem.end_kb,                  \
+                    (unsigned long long)t->mem.peak_kb,                 \
+                    (unsigned long long)t->mem.minor_faults,            \
+                    (unsigned long long)t->mem.major_faults);           \
+            }                                                           \
+            fprintf(f, "\n");                                           \
+        }                                                               \
+        fclose(f);                                                      \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Read a line of F, however long, into LINE without its newline.       \
+ * Returns 1 for a line, 0 at the end of the file, or -1 for a line     \
+ * longer than GREATESTPP_MAX_LINE. */                                  \
+int greatestpp_read_line(FILE *f, std::string *line) {                  \
+    char buf[1024];                                                     \
+    line->clear();                                                      \
+    while (fgets(buf, sizeof(buf), f)) {                                \
+        size_t len = strlen(buf);                                       \
+        int done = len > 0 && buf[len - 1] == '\n';                     \
+        line->append(buf, done ? len - 1 : len);                        \
+        if (line->size() > GREATESTPP_MAX_LINE) return -1;              \
+        if (done) return 1;                                             \
+    }                                                                   \
+    return line->empty() ? 0 : 1;                                       \
+}                                                                       \
+                                                                        \
+/* Load a baseline written by --bench-save. Each line has a suite,      \
+ * benchmark name, iteration count and sample count, then the samples   \
+ * in ns per iteration, separated by tabs. Returns 0 on error,          \
+ * including a line that's too long or doesn't have that form. */       \
+int greatestpp_load_bench_baseline(const char *path) {                  \
+    FILE *f = fopen(path, "r");                                         \
+    std::string line;                                                   \
+    int got;                                                            \
+    if (f == NULL) return 0;                                            \
+    while ((got = greatestpp_read_line(f, &line)) > 0) {                \
+        greatestpp_bench_baseline base;                                 \
+        char *field[5];                                                 \
+        char *p = &line[0];                                             \
+        char *end;                                                      \
+        unsigned long count, i;                                         \
+        if (line.empty() || line[0] == '#') continue;                   \
+        for (i = 0; i < 5; i++) {                                       \
+            field[i] = p;                                               \
+            p = strchr(p, '\t');                                        \
+            if (p == NULL) break;                                       \
+            *p++ = '\0';                                                \
+        }                                                               \
+        if (i != 4) break;                                              \
+        base.suite = field[0];                                          \
+        base.name = field[1];                                           \
+        count = strtoul(field[3], &end, 10);                            \
+        if (end == field[3] || *end != '\0') break;                     \
+        p = field[4];                                                   \
+        for (i = 0; i < count; i++) {                                   \
+            double ns = strtod(p, &end);                                \
+            if (end == p) break;                                        \
+            base.samples.push_back(ns);                                 \
+            p = end;                                                    \
+        }                                                               \
+        if (i < count || strspn(p, " \r") != strlen(p)) break;          \
+        greatestpp_bench_baselines.push_back(base);                     \
+    }                                                                   \
+    fclose(f);                                                          \
+    return got == 0;                                                    \
+}                                                                       \
+                                                                        \
+/* Write the finished benchmarks to the --bench-save file. */           \
+void greatestpp_save_bench_baseline(void) {                             \
+    FILE *f;                                                            \
+    size_t i, j;                                                        \
+    if (!greatestpp_info.bench_save_file) return;                       \
+    f = fopen(greatestpp_info.bench_save_file, "w");                    \
+    if (f == NULL) {                                                    \
+        fprintf(greatestpp_notes(), "Could not write baseline to %s\n", \
+            greatestpp_info.bench_save_file);                           \
+        return;                                                         \
+    }                                                                   \
+    fprintf(f, "# suite\tbench\titerations\tsamples\tns/op...\n");      \
+    for (i = 0; i < greatestpp_bench_results.size(); i++) {             \
+        const greatestpp_bench_result *r = &greatestpp_bench_results[i]; \
+        fprintf(f, "%s\t%s\t%llu\t%u\t", r->suite, r->name,             \
+            (unsigned long long)r->iterations, (unsigned int)r->samples.size()); \
+        for (j = 0; j < r->samples.size(); j++) {                       \
+            fprintf(f, "%s%.17g", j ? " " : "", r->samples[j]);         \
+        }                                                               \
+        fprintf(f, "\n");                                               \
+    }                                                                   \
+    fclose(f);                                                          \
+}                                                                       \
+                                                                        \
+/* Read the --cache file, or GREATESTPP_DEFAULT_CACHE_FILE, unless      \
+ * there's --no-cache. Each line has a suite, test name, result and     \
+ * wall time in ns, separated by tabs. A missing file is fine: it's     \
+ * written at the end of the run. */                                    \
+void greatestpp_load_cache(void) {                                      \
+    FILE *f;                                                            \
+    char line[1024];                                                    \
+    if (greatestpp_info.flags & GREATESTPP_FLAG_NO_CACHE) {             \
+        if (greatestpp_info.cache_file != NULL                          \
+            || (greatestpp_info.flags & (GREATESTPP_FLAG_FAILED_FIRST   \
+                    | GREATESTPP_FLAG_RERUN_FAILED                      \
+                    | GREATESTPP_FLAG_ORDER_DURATION))) {               \
+            fprintf(greatestpp_notes(), "--no-cache can't be used with " \
+                "--cache, --failed-first, --rerun-failed or "           \
+                "--order=duration\n");                                  \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+        return;                                                         \
+    }                                                                   \
+    if (greatestpp_info.cache_file == NULL) {                           \
+        greatestpp_info.cache_file = GREATESTPP_DEFAULT_CACHE_FILE;     \
+    }                                                                   \
+    greatestpp_info.flags |= GREATESTPP_FLAG_TIMINGS;                   \
+    f = fopen(greatestpp_info.cache_file, "r");                         \
+    if (f == NULL) return;                                              \
+    while (fgets(line, sizeof(line), f)) {                              \
+        greatestpp_cache_entry e;                                       \
+        char *name = strchr(line, '\t');                                \
+        char *res = name ? strchr(name + 1, '\t') : NULL;               \
+        char *wall = res ? strchr(res + 1, '\t') : NULL;                \
+        if (line[0] == '#' || wall == NULL) continue;                   \
+        *res++ = '\0';                                                  \
+        *wall++ = '\0';                                                 \
+        e.res = 0 == strncmp(res, "fail", 4) ? -1                       \
+            : 0 == strncmp(res, "skip", 4) ? 1 : 0;                     \
+        e.wall_ns = strtoull(wall, NULL, 10);                           \
+        if (e.res < 0) greatestpp_info.cache_failures++;                \
+        greatestpp_cache[line] = e;                                     \
+    }                                                                   \
+    fclose(f);                                                          \
+}                                                                       \
+                                                                        \
+/* Update the --cache file with this run's results, keeping the entries  \
+ * of tests that didn't run. */                                         \
+void greatestpp_save_cache(void) {                                      \
+    std::vector<std::string> keys;                                      \
+    FILE *f;                                                            \
+    size_t i;                                                           \
+    if (greatestpp_info.cache_file == NULL || GREATESTPP_BENCH_MODE()) return; \
+    for (i = 0; i < greatestpp_timings.size(); i++) {                   \
+        const greatestpp_timing *t = &greatestpp_timings[i];            \
+        greatestpp_cache_entry e;                                       \
+        std::string key(t->suite);                                      \
+        key += '\t';                                                    \
+        key += t->name;                                                 \
+        e.res = t->res;                                                 \
+        e.wall_ns = t->wall_ns;                                         \
+        greatestpp_cache[key] = e;                                      \
+    }                                                                   \
+    f = fopen(greatestpp_info.cache_file, "w");                         \
+    if (f == NULL) {                                                    \
+        fprintf(greatestpp_notes(), "Could not write cache to %s\n",    \
+            greatestpp_info.cache_file);                                \
+        return;                                                         \
+    }                                                                   \
+    for (std::unordered_map<std::string, greatestpp_cache_entry>::const_iterator \
+             it = greatestpp_cache.begin(); it != greatestpp_cache.end(); ++it) { \
+        keys.push_back(it->first);                                      \
+    }                                                                   \
+    std::sort(keys.begin(), keys.end());                                \
+    fprintf(f, "# suite\ttest\tresult\twall_ns\n");                     \
+    for (i = 0; i < keys.size(); i++) {                                 \
+        const greatestpp_cache_entry *e = &greatestpp_cache[keys[i]];   \
+        fprintf(f, "%s\t%s\t%llu\n", keys[i].c_str(),                   \
+            e->res < 0 ? "fail" : e->res > 0 ? "skip" : "pass",         \
+            (unsigned long long)e->wall_ns);                            \
+    }                                                                   \
+    fclose(f);                                                          \
+}                                                                       \
+                                                                        \
+static bool greatestpp_longer(const std::pair<uint64_t, std::string> &a, \
+                              const std::pair<uint64_t, std::string> &b) { \
+    return a.first != b.first ? a.first > b.first : a.second < b.second; \
+}                                                                       \
+                                                                        \
+/* Split the tests in the --shard-timings file (a --timings or --cache  \
+ * file) into --shard shards of about equal total time: longest first,  \
+ * each to the shard with the least time so far. The order is fixed,    \
+ * so every shard computes the same plan. */                            \
+void greatestpp_plan_shards(void) {                                     \
+    std::unordered_map<std::string, uint64_t> wall;                     \
+    std::vector<std::pair<uint64_t, std::string> > tests;               \
+    std::vector<uint64_t> load(greatestpp_info.shard_count, 0);         \
+    FILE *f;                                                            \
+    char line[1024];                                                    \
+    size_t i, s;                                                        \
+    if (greatestpp_info.shard_count == 0                                \
+        || greatestpp_info.shard_timings_file == NULL) {                \
+        return;                                                         \
+    }                                                                   \
+    f = fopen(greatestpp_info.shard_timings_file, "r");                 \
+    if (f == NULL) {                                                    \
+        fprintf(greatestpp_notes(), "Could not read shard timings %s\n", \
+            greatestpp_info.shard_timings_file);                        \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+    while (fgets(line, sizeof(line), f)) {                              \
+        char *name = strchr(line, '\t');                                \
+        char *res = name ? strchr(name + 1, '\t') : NULL;               \
+        char *ns = res ? strchr(res + 1, '\t') : NULL;                  \
+        if (line[0] == '#' || ns == NULL) continue;                     \
+        *res = '\0';                                                    \
+        /* A test run several times counts once, with its total time. */ \
+        wall[line] += strtoull(ns + 1, NULL, 10);                       \
+    }                                                                   \
+    fclose(f);                                                          \
+    for (std::unordered_map<std::string, uint64_t>::const_iterator      \
+             it = wall.begin(); it != wall.end(); ++it) {               \
+        tests.push_back(std::make_pair(it->second, it->first));         \
+    }                                                                   \
+    std::sort(tests.begin(), tests.end(), greatestpp_longer);           \
+    for (i = 0; i < tests.size(); i++) {                                \
+        size_t least = 0;                                               \
+        for (s = 1; s < load.size(); s++) {                             \
+            if (load[s] < load[least]) least = s;                       \
+        }                                                               \
+        load[least] += tests[i].first;                                  \
+        greatestpp_shard_plan[tests[i].second] = (unsigned int)least;   \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void greatestpp_add_record(greatestpp_corpus *c, const char *test, \
+        const char *key, size_t key_len,                                \
+        greatestpp_slice input, greatestpp_slice expected) {            \
+    greatestpp_record r;                                                \
+    std::string name(test);                                             \
+    name += '/';                                                        \
+    if (key_len > 0) {                                                  \
+        name.append(key, key_len);                                      \
+    } else {                                                            \
+        name += std::to_string(c->records.size());                      \
+    }                                                                   \
+    c->names.push_back(name);                                           \
+    r.index = c->records.size();                                        \
+    r.name = c->names.back().c_str();                                   \
+    r.key.data = r.name + strlen(test) + 1;                             \
+    r.key.size = c->names.back().size() - strlen(test) - 1;             \
+    r.input = input;                                                    \
+    r.expected = expected;                                              \
+    c->records.push_back(r);                                            \
+}                                                                       \
+                                                                        \
+/* Length of the line at P, without its "\n" or "\r\n". */              \
+static size_t greatestpp_line_len(const char *p, const char *next) {    \
+    if (next > p && next[-1] == '\n') next--;                           \
+    if (next > p && next[-1] == '\r') next--;                           \
+    return (size_t)(next - p);                                          \
+}                                                                       \
+                                                                        \
+/* Split a corpus file into its "=== key" records, or make it a single  \
+ * record named KEY if it has none. */                                  \
+static void greatestpp_parse_corpus(greatestpp_corpus *c, const char *test, \
+        greatestpp_slice file, const char *key) {                       \
+    const char *p = file.data;                                          \
+    const char *end = file.data + file.size;                            \
+    const char *rec_key = NULL;                                         \
+    size_t rec_key_len = 0;                                             \
+    const char *body = NULL;                                            \
+    const char *sep = NULL;         /* the "--- expected" line */       \
+    const char *sep_end = NULL;                                         \
+    for (;;) {                                                          \
+        const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p)); \
+        const char *next = nl ? nl + 1 : end;                           \
+        size_t len = greatestpp_line_len(p, next);                      \
+        int header = p == end || (len >= 3 && 0 == memcmp(p, "===", 3)  \
+            && (len == 3 || p[3] == ' '));                              \
+        if (header && rec_key != NULL) {                                \
+            greatestpp_slice input, expected;                           \
+            input.data = body;                                          \
+            input.size = (size_t)((sep ? sep : p) - body);              \
+            expected.data = sep ? sep_end : "";                         \
+            expected.size = sep ? (size_t)(p - sep_end) : 0;            \
+            greatestpp_add_record(c, test, rec_key, rec_key_len,        \
+                input, expected);                                       \
+        }                                                               \
+        if (p == end) break;                                            \
+        if (header) {                                                   \
+            rec_key = p + 3;                                            \
+            rec_key_len = len - 3;                                      \
+            while (rec_key_len > 0 && *rec_key == ' ') {                \
+                rec_key++;                                              \
+                rec_key_len--;                                          \
+            }                                                           \
+            body = next;                                                \
+            sep = NULL;                                                 \
+        } else if (rec_key != NULL && sep == NULL && len == 12          \
+            && 0 == memcmp(p, "--- expected", 12)) {                    \
+            sep = p;                                                    \
+            sep_end = next;                                             \
+        }                                                               \
+        p = next;                                                       \
+    }                                                                   \
+    if (rec_key == NULL) {                                              \
+        greatestpp_slice none = { "", 0 };                              \
+        greatestpp_add_record(c, test, key, strlen(key), file, none);   \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+/* Load the corpus at PATH for RUN_CORPUS. It stays loaded until the    \
+ * end of the run, since queued tests and the timings point into it. */ \
+greatestpp_corpus *greatestpp_load_corpus(const char *test, const char *path) { \
+    std::unique_ptr<greatestpp_corpus> c(new greatestpp_corpus());      \
+    std::vector<std::string> files;                                     \
+    greatestpp_slice data;                                              \
+    size_t i;                                                           \
+    if (greatestpp_corpus_files(path, &files)) {                        \
+        for (i = 0; i < files.size(); i++) {                            \
+            const std::string &name = files[i];                         \
+            std::string file = std::string(path) + "/" + name;          \
+            greatestpp_slice expected = { "", 0 };                      \
+            if (name.size() > 9                                         \
+                && 0 == name.compare(name.size() - 9, 9, ".expected")   \
+                && std::binary_search(files.begin(), files.end(),       \
+                    name.substr(0, name.size() - 9))) {                 \
+                continue;           /* read along with its input */     \
+            }                                                           \
+            if (!greatestpp_map_file(c.get(), file.c_str(), &data)      \
+                || (std::binary_search(files.begin(), files.end(),      \
+                        name + ".expected")                             \
+                    && !greatestpp_map_file(c.get(),                    \
+                        (file + ".expected").c_str(), &expected))) {    \
+                fprintf(greatestpp_notes(), "Could not read corpus %s\n", \
+                    file.c_str());                                      \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_add_record(c.get(), test, name.data(), name.size(), \
+                data, expected);                                        \
+        }                                                               \
+    } else {                                                            \
+        const char *base = strrchr(path, '/');                          \
+        if (!greatestpp_map_file(c.get(), path, &data)) {               \
+            fprintf(greatestpp_notes(), "Could not read corpus %s\n", path); \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+        greatestpp_parse_corpus(c.get(), test, data, base ? base + 1 : path); \
+    }                                                                   \
+    greatestpp_corpora.push_back(std::move(c));                         \
+    return greatestpp_corpora.back().get();                             \
+}                                                                       \
+                                                                        \
+/* Parse ARG as a whole number that fits in an unsigned int, such as a  \
+ * count or a time in ms, into *OUT. Returns 0 if it isn't one. */      \
+static int greatestpp_parse_uint(const char *arg, unsigned int *out) {  \
+    unsigned long n;                                                    \
+    char *end;                                                          \
+    if (*arg < '0' || *arg > '9') return 0;                             \
+    errno = 0;                                                          \
+    n = strtoul(arg, &end, 10);                                         \
+    if (*end != '\0' || errno == ERANGE || n > UINT_MAX) return 0;      \
+    *out = (unsigned int)n;                                             \
+    return 1;                                                           \
+}                                                                       \
+                                                                        \
+/* Handle command-line arguments. */                                    \
+void greatestpp_parse_args(int argc, char **argv) {                     \
+    int i = 0;                                                          \
+    for (i = 1; i < argc; i++) {                                        \
+        if (0 == strcmp("-t", argv[i])) {                               \
+            /* An empty pattern would match every name. */              \
+            if (argc <= i + 1 || argv[i+1][0] == '\0') {                \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_add_filter(&greatestpp_filter_info.tests.include, \
+                argv[i+1]);                                             \
+            i++;                                                        \
+        } else if (0 == strcmp("-s", argv[i])) {                        \
+            if (argc <= i + 1 || argv[i+1][0] == '\0') {                \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_add_filter(&greatestpp_filter_info.suites.include, \
+                argv[i+1]);                                             \
+            i++;                                                        \
+        } else if (0 == strcmp("-x", argv[i])) {                        \
+            if (argc <= i + 1 || argv[i+1][0] == '\0') {                \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_add_filter(&greatestpp_filter_info.tests.exclude, \
+                argv[i+1]);                                             \
+            i++;                                                        \
+        } else if (0 == strcmp("-X", argv[i])) {                        \
+            if (argc <= i + 1 || argv[i+1][0] == '\0') {                \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_add_filter(&greatestpp_filter_info.suites.exclude, \
+                argv[i+1]);                                             \
+            i++;                                                        \
+        } else if (0 == strcmp("--filter-file", argv[i])) {             \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            if (!greatestpp_load_filter_file(argv[i+1])) {              \
+                fprintf(greatestpp_notes(),                             \
+                    "Bad or unreadable filter file %s\n", argv[i+1]);   \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("-j", argv[i])) {                        \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.jobs)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            if (greatestpp_info.jobs == 0) {                            \
+                greatestpp_info.jobs = std::thread::hardware_concurrency(); \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("-p", argv[i])) {                        \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.forks)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            if (greatestpp_info.forks == 0) {                           \
+                greatestpp_info.forks = std::thread::hardware_concurrency(); \
+            }                                                           \
+            if (!GREATESTPP_HAVE_FORK) {                                \
+                fprintf(greatestpp_notes(),                             \
+                    "-p is not supported here, using threads instead\n"); \
+                greatestpp_info.jobs = greatestpp_info.forks;           \
+                greatestpp_info.forks = 0;                              \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--fork-batch", argv[i])) {              \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.fork_batch)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--async", argv[i])) {                   \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.async_limit)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            if (greatestpp_info.async_limit == 0) {                     \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--slowest", argv[i])) {                 \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.slowest)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.flags |= GREATESTPP_FLAG_TIMINGS;           \
+            i++;                                                        \
+        } else if (0 == strcmp("--timings", argv[i])) {                 \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.timings_file = argv[i+1];                   \
+            greatestpp_info.flags |= GREATESTPP_FLAG_TIMINGS;           \
+            i++;                                                        \
+        } else if (0 == strcmp("--shard", argv[i])) {                   \
+            int used = 0;                                               \
+            if (argc <= i + 1                                           \
+                || sscanf(argv[i+1], "%u/%u%n", &greatestpp_info.shard_index, \
+                    &greatestpp_info.shard_count, &used) != 2           \
+                || argv[i+1][used] != '\0'                              \
+                || strchr(argv[i+1], '-') != NULL                       \
+                || greatestpp_info.shard_index                          \
+                    >= greatestpp_info.shard_count) {                   \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--shard-timings", argv[i])) {           \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.shard_timings_file = argv[i+1];             \
+            i++;                                                        \
+        } else if (0 == strcmp("--journal", argv[i])) {                 \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.journal_file = argv[i+1];                   \
+            i++;                                                        \
+        } else if (0 == strcmp("--journal-report", argv[i])) {          \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.journal_report_file = argv[i+1];            \
+            i++;                                                        \
+        } else if (0 == strcmp("--cache", argv[i])) {                   \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.cache_file = argv[i+1];                     \
+            i++;                                                        \
+        } else if (0 == strcmp("--no-cache", argv[i])) {                \
+            greatestpp_info.flags |= GREATESTPP_FLAG_NO_CACHE;          \
+        } else if (0 == strcmp("--failed-first", argv[i])) {            \
+            greatestpp_info.flags |= GREATESTPP_FLAG_FAILED_FIRST;      \
+        } else if (0 == strcmp("--rerun-failed", argv[i])) {            \
+            greatestpp_info.flags |= GREATESTPP_FLAG_RERUN_FAILED;      \
+        } else if (0 == strcmp("--order=duration", argv[i])) {          \
+            greatestpp_info.flags |= GREATESTPP_FLAG_ORDER_DURATION;    \
+        } else if (0 == strcmp("--timeout", argv[i])) {                 \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.timeout_ms)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--profile", argv[i])) {                 \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.profile_dir = argv[i+1];                    \
+            i++;                                                        \
+        } else if (0 == strcmp("--profile-threshold", argv[i])) {       \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.profile_threshold_ms)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--stress-time", argv[i])) {             \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.stress_time_ms)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--stress-pin", argv[i])) {              \
+            greatestpp_info.flags |= GREATESTPP_FLAG_STRESS_PIN;        \
+        } else if (0 == strcmp("--memory-report", argv[i])) {           \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.memory_report)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.flags |= GREATESTPP_FLAG_MEMORY;            \
+            greatestpp_info.flags |= GREATESTPP_FLAG_TIMINGS;           \
+            i++;                                                        \
+        } else if (0 == strcmp("--perf", argv[i])) {                    \
+            greatestpp_info.flags |= GREATESTPP_FLAG_PERF;              \
+        } else if (0 == strcmp("--bench", argv[i])) {                   \
+            greatestpp_info.flags |= GREATESTPP_FLAG_BENCH;             \
+            greatestpp_info.flags |= GREATESTPP_FLAG_VERBOSE;           \
+        } else if (0 == strcmp("--bench-time", argv[i])) {              \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.bench_time_ms)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--bench-samples", argv[i])) {           \
+            if (argc <= i + 1                                           \
+                || !greatestpp_parse_uint(argv[i+1], &greatestpp_info.bench_samples)) { \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--bench-save", argv[i])) {              \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.bench_save_file = argv[i+1];                \
+            i++;                                                        \
+        } else if (0 == strcmp("--bench-compare", argv[i])) {           \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.bench_compare_file = argv[i+1];             \
+            if (!greatestpp_load_bench_baseline(argv[i+1])) {           \
+                fprintf(greatestpp_notes(),                             \
+                    "Could not read baseline %s\n", argv[i+1]);         \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--bench-threshold", argv[i])) {         \
+            char *end;                                                  \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.bench_threshold = strtod(argv[i+1], &end);  \
+            /* Written so that NaN fails too. */                        \
+            if (end == argv[i+1] || *end != '\0'                        \
+                || !(greatestpp_info.bench_threshold >= 0)              \
+                || isinf(greatestpp_info.bench_threshold)) {            \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--tag", argv[i])) {                     \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.tag_filter = argv[i+1];                     \
+            i++;                                                        \
+        } else if (0 == strcmp("--reporter", argv[i])) {                \
+            size_t r;                                                   \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.reporter = NULL;                            \
+            for (r = 0; r < sizeof(greatestpp_reporters)                \
+                     / sizeof(greatestpp_reporters[0]); r++) {          \
+                if (0 == strcmp(greatestpp_reporters[r].name, argv[i+1])) { \
+                    greatestpp_info.reporter = &greatestpp_reporters[r]; \
+                }                                                       \
+            }                                                           \
+            if (greatestpp_info.reporter == NULL) {                     \
+                fprintf(greatestpp_notes(),                             \
+                    "Unknown reporter '%s'\n", argv[i+1]);              \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            i++;                                                        \
+        } else if (0 == strcmp("--output", argv[i])) {                  \
+            if (argc <= i + 1) {                                        \
+                greatestpp_usage(argv[0]);                              \
+                exit(EXIT_FAILURE);                                     \
+            }                                                           \
+            greatestpp_info.out_path = argv[i+1];                       \
+            i++;                                                        \
+        } else if (0 == strcmp("-f", argv[i])) {                        \
+            greatestpp_info.flags |= GREATESTPP_FLAG_FIRST_FAIL;        \
+        } else if (0 == strcmp("-v", argv[i])) {                        \
+            greatestpp_info.flags |= GREATESTPP_FLAG_VERBOSE;           \
+        } else if (0 == strcmp("-l", argv[i])) {                        \
+            greatestpp_info.flags |= GREATESTPP_FLAG_LIST_ONLY;         \
+        } else if (0 == strcmp("-h", argv[i])) {                        \
+            greatestpp_usage(argv[0]);                                  \
+            exit(EXIT_SUCCESS);                                         \
+        } else {                                                        \
+            fprintf(greatestpp_notes(),                                 \
+                "Unknown argument '%s'\n", argv[i]);                    \
+            greatestpp_usage(argv[0]);                                  \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    }                                                                   \
+    /* Without fork, -p already fell back to threads. */                \
+    if (GREATESTPP_HAVE_FORK && greatestpp_info.fork_batch > 0          \
+        && greatestpp_info.forks == 0) {                                \
+        fprintf(greatestpp_notes(), "--fork-batch can't be used without -p\n"); \
+        exit(EXIT_FAILURE);                                             \
+    }                                                                   \
+}                                                                       \
+                                                                        \
 void GREATESTPP_SET_SETUP_CB(greatestpp_setup_cb *cb, void *udata) {        \
     greatestpp_info.setup = cb;                                           \
     greatestpp_info.setup_udata = udata;                                  \
@@ -503,76 +5901,123 @@ void GREATESTPP_SET_TEARDOWN_CB(greatestpp_teardown_cb *cb,                 \
     greatestpp_info.teardown_udata = udata;                               \
 }                                                                       \
                                                                         \
+/* Destroy the calling thread's fixtures of SCOPE, or all of them for   \
+ * GREATESTPP_SCOPE_GLOBAL, newest first. */                            \
+static void greatestpp_release_slots(greatestpp_fixture_set *set,       \
+                                     GREATESTPP_SCOPE scope) {          \
+    std::vector<greatestpp_fixture_slot> &slots = set->slots;           \
+    size_t i = slots.size();                                            \
+    while (i-- > 0) {                                                   \
+        greatestpp_fixture_slot slot = slots[i];                        \
+        if (scope == GREATESTPP_SCOPE_SUITE                             \
+            && slot.scope != GREATESTPP_SCOPE_SUITE) {                  \
+            continue;                                                   \
+        }                                                               \
+        slots.erase(slots.begin() + i);                                 \
+        slot.destroy(slot.instance);                                    \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+void greatestpp_release_fixtures(GREATESTPP_SCOPE scope) {              \
+    greatestpp_release_slots(&greatestpp_fixtures, scope);              \
+}                                                                       \
+                                                                        \
+greatestpp_fixture_set::~greatestpp_fixture_set() {                     \
+    greatestpp_release_slots(this, GREATESTPP_SCOPE_GLOBAL);            \
+}                                                                       \
+                                                                        \
+/* Record where and why the calling thread's test failed. */            \
+void greatestpp_fail_at(const char *msg, const char *file,              \
+                        unsigned int line) {                            \
+    greatestpp_test.msg = msg;                                          \
+    greatestpp_test.fail_file = file;                                   \
+    greatestpp_test.fail_line = line;                                   \
+}                                                                       \
+                                                                        \
+/* Set the timeout for the rest of the current suite's tests. */        \
+void GREATESTPP_SET_TIMEOUT(unsigned int ms) {                          \
+    greatestpp_info.suite_timeout_ms = ms;                              \
+}                                                                       \
+                                                                        \
+thread_local greatestpp_test_info greatestpp_test;                      \
+thread_local greatestpp_fixture_set greatestpp_fixtures;                \
+thread_local std::string greatestpp_fail_msg;                           \
+greatestpp_filters greatestpp_filter_info;                              \
+greatestpp_pool greatestpp_workers;                                     \
+greatestpp_watchdog greatestpp_watch;                                   \
+std::vector<greatestpp_timing> greatestpp_timings;                      \
+std::vector<greatestpp_bench_result> greatestpp_bench_results;          \
+std::vector<greatestpp_bench_baseline> greatestpp_bench_baselines;      \
+std::unordered_map<std::string, greatestpp_cache_entry> greatestpp_cache; \
+std::unordered_map<std::string, unsigned int> greatestpp_shard_plan;    \
+std::vector<std::unique_ptr<greatestpp_corpus> > greatestpp_corpora;    \
+greatestpp_journal greatestpp_journal_out;                              \
+GREATESTPP_ASYNC_GLOBALS                                                \
 greatestpp_run_info greatestpp_info
 
 /* Handle command-line arguments, etc. */
 #define GREATESTPP_MAIN_BEGIN()                                           \
     do {                                                                \
-        int i = 0;                                                      \
         memset(&greatestpp_info, 0, sizeof(greatestpp_info));               \
         if (greatestpp_info.width == 0) {                                 \
             greatestpp_info.width = GREATESTPP_DEFAULT_WIDTH;               \
         }                                                               \
-        for (i = 1; i < argc; i++) {                                    \
-            if (0 == strcmp("-t", argv[i])) {                           \
-                if (argc <= i + 1) {                                    \
-                    greatestpp_usage(argv[0]);                            \
-                    exit(EXIT_FAILURE);                                 \
-                }                                                       \
-                greatestpp_info.test_filter = argv[i+1];                  \
-                i++;                                                    \
-            } else if (0 == strcmp("-s", argv[i])) {                    \
-                if (argc <= i + 1) {                                    \
-                    greatestpp_usage(argv[0]);                            \
-                    exit(EXIT_FAILURE);                                 \
-                }                                                       \
-                greatestpp_info.suite_filter = argv[i+1];                 \
-                i++;                                                    \
-            } else if (0 == strcmp("-f", argv[i])) {                    \
-                greatestpp_info.flags |= GREATESTPP_FLAG_FIRST_FAIL;        \
-            } else if (0 == strcmp("-v", argv[i])) {                    \
-                greatestpp_info.flags |= GREATESTPP_FLAG_VERBOSE;           \
-            } else if (0 == strcmp("-l", argv[i])) {                    \
-                greatestpp_info.flags |= GREATESTPP_FLAG_LIST_ONLY;         \
-            } else if (0 == strcmp("-h", argv[i])) {                    \
-                greatestpp_usage(argv[0]);                                \
-                exit(EXIT_SUCCESS);                                     \
-            } else {                                                    \
-                fprintf(GREATESTPP_STDOUT,                                \
-                    "Unknown argument '%s'\n", argv[i]);                \
-                greatestpp_usage(argv[0]);                                \
-                exit(EXIT_FAILURE);                                     \
-            }                                                           \
-        }                                                               \
+        greatestpp_info.jobs = 1;                                       \
+        greatestpp_info.bench_time_ms = GREATESTPP_DEFAULT_BENCH_TIME_MS; \
+        greatestpp_info.bench_samples = GREATESTPP_DEFAULT_BENCH_SAMPLES; \
+        greatestpp_info.bench_threshold = GREATESTPP_DEFAULT_BENCH_THRESHOLD; \
+        greatestpp_info.async_limit = GREATESTPP_DEFAULT_ASYNC_LIMIT;   \
+        greatestpp_info.stress_time_ms = GREATESTPP_DEFAULT_STRESS_TIME_MS; \
+        greatestpp_parse_args(argc, argv);                              \
+        greatestpp_compile_filters();                                   \
+        greatestpp_load_cache();                                        \
+        greatestpp_plan_shards();                                       \
+        greatestpp_perf_init();                                         \
+        greatestpp_profile_init();                                      \
+        greatestpp_memory_init();                                       \
+        greatestpp_open_report();                                       \
+        greatestpp_replay_journal();                                    \
+        greatestpp_open_journal();                                      \
     } while (0);                                                        \
-    GREATESTPP_SET_TIME(greatestpp_info.begin)
+    GREATESTPP_SET_PROCESS_TIME(greatestpp_info.begin)
 
 #define GREATESTPP_MAIN_END()                                             \
     do {                                                                \
         if (!GREATESTPP_LIST_ONLY()) {                                    \
-            GREATESTPP_SET_TIME(greatestpp_info.end);                       \
-            fprintf(GREATESTPP_STDOUT,                                    \
-                "\nTotal: %u tests", greatestpp_info.tests_run);          \
-            GREATESTPP_CLOCK_DIFF(greatestpp_info.begin,                    \
-                greatestpp_info.end);                                     \
-            fprintf(GREATESTPP_STDOUT, "\n");                             \
-            fprintf(GREATESTPP_STDOUT,                                    \
-                "Pass: %u, fail: %u, skip: %u.\n",                      \
-                greatestpp_info.passed,                                   \
-                greatestpp_info.failed, greatestpp_info.skipped);           \
+            GREATESTPP_SET_PROCESS_TIME(greatestpp_info.end);           \
+            greatestpp_info.reporter->run_end();                        \
+            if (greatestpp_info.bench_compare_file) {                   \
+                fprintf(greatestpp_notes(), "Benchmark regressions: %u.\n", \
+                    greatestpp_info.bench_regressions);                 \
+            }                                                           \
+            greatestpp_report_timings();                                \
+            greatestpp_save_bench_baseline();                           \
+            greatestpp_save_cache();                                    \
+            greatestpp_close_journal();                                 \
         }                                                               \
+        greatestpp_close_report();                                      \
         return (greatestpp_info.failed > 0                                \
+            || greatestpp_info.bench_regressions > 0                    \
             ? EXIT_FAILURE : EXIT_SUCCESS);                             \
     } while (0)
 
 /* Make abbreviations without the GREATEST_ prefix for the
  * most commonly used symbols. */
-#if GREATEST_USE_ABBREVS
+#if GREATESTPP_USE_ABBREVS
 #define TEST           GREATESTPP_TEST
 #define SUITE          GREATESTPP_SUITE
 #define RUN_TEST       GREATESTPP_RUN_TEST
 #define RUN_TEST1      GREATESTPP_RUN_TEST1
+#define RUN_TEST_TIMEOUT GREATESTPP_RUN_TEST_TIMEOUT
+#define RUN_CORPUS     GREATESTPP_RUN_CORPUS
+#define BENCH          GREATESTPP_BENCH
+#define RUN_BENCH      GREATESTPP_RUN_BENCH
+#define DO_NOT_OPTIMIZE GREATESTPP_DO_NOT_OPTIMIZE
+#define CLOBBER_MEMORY GREATESTPP_CLOBBER_MEMORY
 #define RUN_SUITE      GREATESTPP_RUN_SUITE
+#define TEST_CASE      GREATESTPP_TEST_CASE
+#define TEST_CASE_TAGGED GREATESTPP_TEST_CASE_TAGGED
+#define RUN_REGISTERED GREATESTPP_RUN_REGISTERED
 #define ASSERT         GREATESTPP_ASSERT
 #define ASSERTm        GREATESTPP_ASSERTm
 #define ASSERT_FALSE   GREATESTPP_ASSERT_FALSE
@@ -589,10 +6034,48 @@ greatestpp_run_info greatestpp_info
 #define SKIPm          GREATESTPP_SKIPm
 #define SET_SETUP      GREATESTPP_SET_SETUP_CB
 #define SET_TEARDOWN   GREATESTPP_SET_TEARDOWN_CB
+#define SET_TIMEOUT    GREATESTPP_SET_TIMEOUT
+#define SUITE_FIXTURE  GREATESTPP_SUITE_FIXTURE
+#define GLOBAL_FIXTURE GREATESTPP_GLOBAL_FIXTURE
+#define ASSERT_P99_UNDER GREATESTPP_ASSERT_P99_UNDER
+#define ASSERT_FASTER_THAN GREATESTPP_ASSERT_FASTER_THAN
+#define ASSERT_P99_UNDERm GREATESTPP_ASSERT_P99_UNDERm
+#define ASSERT_FASTER_THANm GREATESTPP_ASSERT_FASTER_THANm
+#define ASSERT_RSS_UNDER GREATESTPP_ASSERT_RSS_UNDER
+#define ASSERT_RSS_UNDERm GREATESTPP_ASSERT_RSS_UNDERm
+#define STRESS_TEST    GREATESTPP_STRESS_TEST
+#define RUN_STRESS     GREATESTPP_RUN_STRESS
+#define RUN_STRESS_N   GREATESTPP_RUN_STRESS_N
+#if GREATESTPP_HAVE_ASYNC
+#define ASYNC_TEST     GREATESTPP_ASYNC_TEST
+#define RUN_ASYNC      GREATESTPP_RUN_ASYNC
+#define AWAIT_READABLE GREATESTPP_AWAIT_READABLE
+#define AWAIT_WRITABLE GREATESTPP_AWAIT_WRITABLE
+#define AWAIT_SLEEP    GREATESTPP_AWAIT_SLEEP
+#define CO_PASS        GREATESTPP_CO_PASS
+#define CO_FAIL        GREATESTPP_CO_FAIL
+#define CO_SKIP        GREATESTPP_CO_SKIP
+#define CO_PASSm       GREATESTPP_CO_PASSm
+#define CO_FAILm       GREATESTPP_CO_FAILm
+#define CO_SKIPm       GREATESTPP_CO_SKIPm
+#define CO_ASSERT      GREATESTPP_CO_ASSERT
+#define CO_ASSERTm     GREATESTPP_CO_ASSERTm
+#define CO_ASSERT_FALSE GREATESTPP_CO_ASSERT_FALSE
+#define CO_ASSERT_FALSEm GREATESTPP_CO_ASSERT_FALSEm
+#define CO_ASSERT_EQ   GREATESTPP_CO_ASSERT_EQ
+#define CO_ASSERT_EQm  GREATESTPP_CO_ASSERT_EQm
+#define CO_ASSERT_STR_EQ GREATESTPP_CO_ASSERT_STR_EQ
+#define CO_ASSERT_STR_EQm GREATESTPP_CO_ASSERT_STR_EQm
+#endif
+#ifdef GREATESTPP_TRACK_ALLOCS
+#define ASSERT_NO_ALLOC GREATESTPP_ASSERT_NO_ALLOC
+#define ASSERT_MAX_ALLOCS GREATESTPP_ASSERT_MAX_ALLOCS
+#define ASSERT_MAX_ALLOCSm GREATESTPP_ASSERT_MAX_ALLOCSm
+#endif
 
-#if __STDC_VERSION__ >= 19901L
-#endif /* C99 */
+#if __cplusplus >= 201103L || __STDC_VERSION__ >= 199901L
 #define RUN_TESTp      GREATESTPP_RUN_TESTp
+#endif /* C99, C++11 */
 #endif /* USE_ABBREVS */
 
 #endif
@@ -0,0 +1,196 @@
+/* Benchmarks of greatestpp's own overhead, for `make bench`.
+ *
+ * With SELFBENCH_TESTS=N in the environment, this is a test runner
+ * with N trivial passing tests. Otherwise, it's a runner whose
+ * benchmarks (run with --bench) each start the former as a child, with
+ * different options, and time it. An operation is one child run, and
+ * the rate reported in items/s is tests per second. Results can be
+ * saved and compared with --bench-save and --bench-compare. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "greatestpp.h"
+
+/* This program, for the children to run. argv[0] isn't enough when
+ * it was found through PATH, so on Linux it's /proc/self/exe. */
+static const char *selfbench_exe;
+
+/* Test names for the child runner, kept for queued tests. */
+static std::vector<std::string> selfbench_names;
+
+TEST trivial(void) {
+    PASS();
+}
+
+SUITE(generated) {
+    size_t i;
+    for (i = 0; i < selfbench_names.size(); i++) {
+        GREATESTPP_RUN_CALL(selfbench_names[i].c_str(), trivial());
+    }
+}
+
+/* Run this program as a child runner with TESTS tests and the options
+ * in ARGS, a NULL-terminated list, with its output discarded. Returns
+ * 0 if it ran and all of its tests passed. */
+static int selfbench_spawn(unsigned long tests, const char *const *args) {
+    std::vector<char *> argv;
+    char count[32];
+    int status = 0;
+    pid_t pid;
+    argv.push_back((char *)selfbench_exe);
+    for (; *args; args++) argv.push_back((char *)*args);
+    argv.push_back(NULL);
+    snprintf(count, sizeof(count), "%lu", tests);
+    fflush(stdout);
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        setenv("SELFBENCH_TESTS", count, 1);
+        execv(selfbench_exe, &argv[0]);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* Run the child runner once per iteration, counting each test run as
+ * an item. */
+static int selfbench_children(greatestpp_bench *b, unsigned long tests,
+                              const char *const *args) {
+    uint64_t i;
+    for (i = 0; i < b->iterations; i++) {
+        if (selfbench_spawn(tests, args) != 0) return -1;
+    }
+    b->items = tests;
+    return 0;
+}
+
+/* Children run without the cache, which every run otherwise writes,
+ * except in the benchmark of it. */
+#define SELFBENCH_CHILD(NAME, TESTS, ...)                               \
+    BENCH NAME(greatestpp_bench *b) {                                   \
+        static const char *const args[] = {                             \
+            "--no-cache", __VA_ARGS__, NULL                             \
+        };                                                              \
+        return selfbench_children(b, TESTS, args);                      \
+    }
+
+static const char *const selfbench_no_args[] = { "--no-cache", NULL };
+
+/* Startup and exit, with no tests. */
+BENCH startup(greatestpp_bench *b) {
+    return selfbench_children(b, 0, selfbench_no_args);
+}
+
+/* The per-test cost of pre_test, post_test and the default reporter. */
+BENCH tests_10k(greatestpp_bench *b) {
+    return selfbench_children(b, 10000, selfbench_no_args);
+}
+
+BENCH tests_100k(greatestpp_bench *b) {
+    return selfbench_children(b, 100000, selfbench_no_args);
+}
+
+BENCH tests_1m(greatestpp_bench *b) {
+    return selfbench_children(b, 1000000, selfbench_no_args);
+}
+
+/* Matching each name against substring, glob and exact patterns. */
+SELFBENCH_CHILD(filtered_100k, 100000,
+    "-t", "test_", "-x", "nothing", "-x", "*_x?9", "-x", "=test_1")
+
+/* Reporter throughput. */
+SELFBENCH_CHILD(verbose_100k, 100000, "-v")
+SELFBENCH_CHILD(tap_100k, 100000, "--reporter", "tap", "--output", "/dev/null")
+SELFBENCH_CHILD(junit_100k, 100000,
+    "--reporter", "junit", "--output", "/dev/null")
+SELFBENCH_CHILD(jsonl_100k, 100000,
+    "--reporter", "jsonl", "--output", "/dev/null")
+
+/* Recording each result and writing the cache. */
+BENCH cache_100k(greatestpp_bench *b) {
+    static const char *const args[] = { "--cache", "/dev/null", NULL };
+    return selfbench_children(b, 100000, args);
+}
+
+/* Scaling across worker threads, including queueing each test. */
+SELFBENCH_CHILD(threads_1_100k, 100000, "-j", "1")
+SELFBENCH_CHILD(threads_2_100k, 100000, "-j", "2")
+SELFBENCH_CHILD(threads_4_100k, 100000, "-j", "4")
+
+/* The cost of one passing assertion. */
+BENCH passing_assert_eq(greatestpp_bench *b) {
+    uint64_t i;
+    for (i = 0; i < b->iterations; i++) {
+        uint64_t j = i;
+        DO_NOT_OPTIMIZE(j);
+        ASSERT_EQ(i, j);
+    }
+    return 0;
+}
+
+BENCH passing_assert_str_eq(greatestpp_bench *b) {
+    char name[] = "test_000123";
+    char other[] = "test_000123";
+    uint64_t i;
+    for (i = 0; i < b->iterations; i++) {
+        CLOBBER_MEMORY();
+        ASSERT_STR_EQ(name, other);
+    }
+    return 0;
+}
+
+SUITE(selfbench) {
+    RUN_BENCH(startup);
+    RUN_BENCH(tests_10k);
+    RUN_BENCH(tests_100k);
+    RUN_BENCH(tests_1m);
+    RUN_BENCH(filtered_100k);
+    RUN_BENCH(verbose_100k);
+    RUN_BENCH(tap_100k);
+    RUN_BENCH(junit_100k);
+    RUN_BENCH(jsonl_100k);
+    RUN_BENCH(cache_100k);
+    RUN_BENCH(threads_1_100k);
+    RUN_BENCH(threads_2_100k);
+    RUN_BENCH(threads_4_100k);
+    RUN_BENCH(passing_assert_eq);
+    RUN_BENCH(passing_assert_str_eq);
+}
+
+GREATESTPP_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    const char *tests = getenv("SELFBENCH_TESTS");
+    selfbench_exe = access("/proc/self/exe", X_OK) == 0
+        ? "/proc/self/exe" : argv[0];
+    if (tests) {
+        unsigned long i, n = strtoul(tests, NULL, 10);
+        char name[32];
+        selfbench_names.reserve(n);
+        for (i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "test_%06lu", i);
+            selfbench_names.push_back(name);
+        }
+    }
+    GREATESTPP_MAIN_BEGIN();
+    if (tests) {
+        RUN_SUITE(generated);
+    } else {
+        RUN_SUITE(selfbench);
+    }
+    GREATESTPP_MAIN_END();
+}
@@ -0,0 +1,87 @@
+/* Subjects for selftest.sh, which runs this program with different
+ * options and checks what it reports, for `make check`. The crashing
+ * and hanging suites are only meant to be run by it, with -p or
+ * --timeout. */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "greatestpp.h"
+
+TEST parse_empty(void) {
+    PASS();
+}
+
+TEST parse_empty_slow(void) {
+    PASS();
+}
+
+TEST lex_one(void) {
+    PASS();
+}
+
+TEST lex_two(void) {
+    PASS();
+}
+
+TEST lex_skipped(void) {
+    SKIPm("not today");
+}
+
+/* Names for the filters and the shards to pick from. */
+SUITE(names) {
+    RUN_TEST(parse_empty);
+    RUN_TEST(parse_empty_slow);
+    RUN_TEST(lex_one);
+    RUN_TEST(lex_two);
+    RUN_TEST(lex_skipped);
+}
+
+TEST fails_with_markup(void) {
+    FAILm("expected <a> & \"b\"");
+}
+
+SUITE(failing) {
+    RUN_TEST(fails_with_markup);
+}
+
+TEST crashes(void) {
+    raise(SIGSEGV);
+    PASS();
+}
+
+TEST after_crash(void) {
+    PASS();
+}
+
+SUITE(crashing) {
+    RUN_TEST(crashes);
+    RUN_TEST(after_crash);
+}
+
+TEST hangs(void) {
+    for (;;) pause();
+    PASS();
+}
+
+TEST after_hang(void) {
+    PASS();
+}
+
+SUITE(hanging) {
+    RUN_TEST(hangs);
+    RUN_TEST(after_hang);
+}
+
+GREATESTPP_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATESTPP_MAIN_BEGIN();
+    RUN_SUITE(names);
+    RUN_SUITE(failing);
+    RUN_SUITE(crashing);
+    RUN_SUITE(hanging);
+    GREATESTPP_MAIN_END();
+}
@@ -0,0 +1,196 @@
+#!/bin/sh
+# Behavior checks for greatestpp, for `make check`: run selftest with
+# different options, and compare what it reports with what it should.
+# Usage: selftest.sh [RUNNER]
+
+runner=${1:-./selftest}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failures=0
+
+# Run the runner without the cache, keeping its stdout, stderr and
+# exit status in $tmp.
+run() {
+    "$runner" --no-cache "$@" >"$tmp/out" 2>"$tmp/err"
+    echo $? >"$tmp/rc"
+}
+
+pass() {
+    printf 'ok   %s\n' "$1"
+}
+
+fail() {
+    printf 'FAIL %s\n' "$1"
+    sed 's/^/     | /' "$tmp/out" "$tmp/err"
+    failures=$((failures + 1))
+}
+
+# The names of the tests the last verbose run reported, sorted, on one
+# line.
+ran() {
+    sed -nE 's/^(PASS|FAIL|SKIP) ([^:]*):.*/\2/p' "$tmp/out" \
+        | sort | tr '\n' ' ' | sed 's/ $//'
+}
+
+# expect_ran NAME EXPECTED ARGS...: the tests run with ARGS are EXPECTED.
+expect_ran() {
+    name=$1
+    expected=$2
+    shift 2
+    run -v "$@"
+    got=$(ran)
+    if [ "$got" = "$expected" ]; then
+        pass "$name"
+    else
+        echo "     expected '$expected', got '$got'"
+        fail "$name"
+    fi
+}
+
+# expect_rc NAME RC ARGS...: the runner exits with RC for ARGS.
+expect_rc() {
+    name=$1
+    expected=$2
+    shift 2
+    run "$@"
+    if [ "$(cat "$tmp/rc")" = "$expected" ]; then
+        pass "$name"
+    else
+        echo "     expected exit status $expected, got $(cat "$tmp/rc")"
+        fail "$name"
+    fi
+}
+
+# expect_out NAME FILE PATTERN...: each fixed string is in FILE, from
+# the last run.
+expect_out() {
+    name=$1
+    file=$2
+    shift 2
+    for pattern in "$@"; do
+        if ! grep -qF -- "$pattern" "$file"; then
+            echo "     missing '$pattern'"
+            fail "$name"
+            return
+        fi
+    done
+    pass "$name"
+}
+
+# expect_no_out NAME FILE PATTERN: the fixed string isn't in FILE.
+expect_no_out() {
+    if grep -qF -- "$3" "$2"; then
+        echo "     unexpected '$3'"
+        fail "$1"
+    else
+        pass "$1"
+    fi
+}
+
+all='lex_one lex_skipped lex_two parse_empty parse_empty_slow'
+
+# Filters: substrings, whole-name globs, exact names and filter files.
+expect_ran "filter: substring" "parse_empty parse_empty_slow" \
+    -s names -t empty
+expect_ran "filter: glob matches the whole name" "parse_empty_slow" \
+    -s names -t '*_slow'
+expect_ran "filter: glob with ? and [...]" "lex_one lex_two" \
+    -s names -t 'lex_[ot]??'
+expect_ran "filter: a glob isn't a substring" "" -s names -t 'lex_?'
+expect_ran "filter: exact name" "parse_empty" -s names -t '=parse_empty'
+expect_ran "filter: exclude" "lex_one lex_two" \
+    -s names -t lex -x skipped
+expect_ran "filter: suite exclude" "$all" -X failing -X crashing \
+    -X hanging
+printf '# comment\nlex\n!=lex_two\n\n' >"$tmp/filters"
+expect_ran "filter: filter file" "lex_one lex_skipped" \
+    -s names --filter-file "$tmp/filters"
+printf 'lex\n!\n' >"$tmp/filters"
+expect_rc "filter: empty exclude in a filter file" 1 \
+    -s names --filter-file "$tmp/filters"
+expect_rc "filter: empty -x" 1 -s names -x ''
+
+# Shards: every test runs in exactly one shard.
+for n in 1 2 3; do
+    got=
+    i=0
+    while [ $i -lt $n ]; do
+        run -v -s names --shard "$i/$n"
+        got="$got $(ran)"
+        i=$((i + 1))
+    done
+    got=$(echo $got | tr ' ' '\n' | sort | tr '\n' ' ' | sed 's/ $//')
+    if [ "$got" = "$all" ]; then
+        pass "shard: split $n ways, each test runs once"
+    else
+        echo "     expected '$all', got '$got'"
+        fail "shard: split $n ways, each test runs once"
+    fi
+done
+expect_rc "shard: index out of range" 1 -s names --shard 2/2
+expect_rc "shard: trailing junk" 1 -s names --shard 0/2x
+
+# -p: a crashing test fails, and the run goes on without it.
+expect_rc "-p: a crash fails the run" 1 -v -s crashing -p 2
+expect_out "-p: the crash is reported, the next test runs" "$tmp/out" \
+    "FAIL crashes: worker crashed" "PASS after_crash" \
+    "Pass: 1, fail: 1, skip: 0."
+
+# --timeout: a hanging test fails. With -p the run goes on; otherwise
+# it stops there.
+expect_rc "--timeout: a hang fails the run" 1 \
+    -v -s hanging --timeout 100 -p 2
+expect_out "--timeout: with -p, the next test runs" "$tmp/out" \
+    "FAIL hangs: TIMEOUT after 100 ms" "PASS after_hang"
+expect_rc "--timeout: without -p, the run stops" 1 \
+    -s hanging --timeout 100
+expect_out "--timeout: without -p, the hang is reported" "$tmp/out" \
+    "FAIL hangs: TIMEOUT after 100 ms" "Pass: 0, fail: 1, skip: 0."
+expect_rc "--timeout: rejects a non-number" 1 --timeout abc
+expect_rc "--timeout: rejects a negative number" 1 --timeout -5
+
+# --journal-report: a journal cut short by a crash reports the results
+# that were recorded.
+run -s names --journal "$tmp/journal"
+expect_rc "--journal-report: a whole journal" 0 \
+    --journal-report "$tmp/journal"
+expect_no_out "--journal-report: a whole journal doesn't end early" \
+    "$tmp/err" "ends early"
+run -s names -s crashing --journal "$tmp/journal"
+expect_rc "--journal-report: a journal cut short" 1 \
+    --journal-report "$tmp/journal"
+expect_out "--journal-report: the recorded results" "$tmp/out" \
+    "Pass: 4, fail: 0, skip: 1." "The journal ends early"
+echo "not a journal" >"$tmp/journal"
+expect_rc "--journal-report: not a journal" 1 \
+    --journal-report "$tmp/journal"
+
+# Reporters: the report alone goes to stdout.
+expect_rc "tap: a failure fails the run" 1 \
+    -s names -s failing --reporter tap --slowest 1
+expect_out "tap: the report" "$tmp/out" "TAP version 13" \
+    "ok 1 - names/parse_empty" "ok 5 - names/lex_skipped # SKIP not today" \
+    "not ok 6 - failing/fails_with_markup" \
+    'message: "expected <a> & \"b\""' "1..6"
+expect_no_out "tap: notes go to stderr" "$tmp/out" "Slowest"
+run -s names -s failing --reporter junit
+expect_out "junit: the report" "$tmp/out" \
+    '<testsuite name="names" tests="5" failures="0" skipped="1"' \
+    '<skipped message="not today"/>' \
+    '<failure message="expected &lt;a&gt; &amp; &quot;b&quot;">'
+run -s names -s failing --reporter jsonl --output "$tmp/report"
+expect_out "jsonl: the report" "$tmp/report" \
+    '"name":"lex_skipped","result":"skip","msg":"not today"' \
+    '"result":"fail","msg":"expected <a> & \"b\""' \
+    '{"type":"run","tests":6,"passed":4,"failed":1,"skipped":1,'
+if [ "$(grep -vc '^{.*}$' "$tmp/report")" = 0 ]; then
+    pass "jsonl: one object per line"
+else
+    fail "jsonl: one object per line"
+fi
+
+if [ $failures -ne 0 ]; then
+    echo "$failures checks failed"
+    exit 1
+fi
+echo "All checks passed"